@@ -41,6 +41,8 @@
  */
 #include <linux/firmware.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/scatterlist.h>
 #include "pm8001_sas.h"
 #include "pm8001_ctl.h"
 
@@ -294,6 +296,32 @@ static PMCS_DEVICE_ATTR(host_sas_address, S_IRUGO | S_IWUSR,
 		   pm8001_ctl_host_sas_address_show,
 		   pm8001_ctl_host_sas_address_store);
 
+/**
+ * pm8001_ctl_init_timings_show - time spent in each bring-up wait
+ * @cdev: pointer to embedded class device
+ * @buf: the buffer returned
+ *
+ * A sysfs 'read-only' shost attribute. One "phase microseconds" pair
+ * per line, from the most recent chip init, reset or HDA boot.
+ */
+static ssize_t pm8001_ctl_init_timings_show(struct PMCS_SYSFS_DEV *cdev,
+	PMCS_ATTR_ARG char *buf)
+{
+	struct Scsi_Host *shost = class_to_shost(cdev);
+	struct sas_ha_struct *sha = SHOST_TO_SAS_HA(shost);
+	struct pm8001_hba_info *pm8001_ha = sha->lldd_ha;
+	ssize_t l = 0;
+	int i;
+
+	for (i = 0; i < PM8001_PHASE_MAX; i++)
+		l += snprintf(buf + l, PAGE_SIZE - l, "%s %u\n",
+			pm8001_init_phase_name[i],
+			pm8001_ha->init_phase_us[i]);
+	return l;
+}
+static PMCS_DEVICE_ATTR(init_timings, S_IRUGO,
+		   pm8001_ctl_init_timings_show, NULL);
+
 /**
  * pm8001_ctl_logging_level_show - logging level
  * @cdev: pointer to embedded class device
@@ -403,15 +431,34 @@ int pm8001_readlog(
 }
 
 /**
- * pm8001_validlog - generic routine to validate a single event log entry
- * @entry: a pointer to the event log entry
- * @return: zero if not valid
+ * pm8001_formatlog - generic routine to render a single event log entry
+ * @entry: a pointer to a valid event log entry
+ * @buf: the buffer to render the text line into
+ * @len: the size of @buf
+ * @return: the length of the line, which is truncated if it exceeds @len.
  */
-static inline int pm8001_validlog(struct eventlog_entry *entry)
+int pm8001_formatlog(struct eventlog_entry *entry, char *buf, size_t len)
 {
-	return ((entry->size <= (sizeof(entry->log) / sizeof(entry->log[0]))) &&
-		((entry->timestamp_upper != 0) ||
-		 (entry->timestamp_lower != 0)));
+	char *str = buf;
+	u32 *lp;
+	int i;
+	unsigned long long timestamp =
+		(((unsigned long long)entry->timestamp_upper) << 32) |
+		entry->timestamp_lower, remainder;
+
+	remainder = do_div(timestamp, 1000000000 / 8) * 8;
+	str += snprintf(str, len - (str - buf),
+		"%u %llu.%09llu %u",
+		entry->severity,
+		timestamp,
+		remainder,
+		entry->sequence);
+	for (lp = entry->log, i = entry->size; i > 0; --i)
+		str += snprintf(str, len - (str - buf), " 0x%08x", *(lp++));
+	/* Here is where we would interpret the log */
+
+	str += snprintf(str, len - (str - buf), "\n");
+	return min_t(int, str - buf, len - 1);
 }
 
 /**
@@ -442,25 +489,8 @@ static ssize_t pm8001_ctl_log_show(struct PMCS_SYSFS_DEV *cdev,
 				&pm8001_ha->aap1_consumer :
 				&pm8001_ha->iop_consumer);
 	} while ((i == 0) && !pm8001_validlog(&entry));
-	if ((i >= 0) && pm8001_validlog(&entry)) {
-		u32 *lp;
-		unsigned long long timestamp =
-			(((unsigned long long)entry.timestamp_upper) << 32) |
-			entry.timestamp_lower, remainder;
-		remainder = do_div(timestamp, 1000000000 / 8) * 8;
-		str += snprintf(str, PAGE_SIZE - (str - buf),
-			"%u %llu.%09llu %u",
-			entry.severity,
-			timestamp,
-			remainder,
-			entry.sequence);
-		for (lp = entry.log, i = entry.size; i > 0; --i)
-			str += snprintf(str, PAGE_SIZE - (str - buf),
-				" 0x%08x", *(lp++));
-		/* Here is where we would interpret the log */
-
-		str += snprintf(str, PAGE_SIZE - (str - buf), "\n");
-	}
+	if ((i >= 0) && pm8001_validlog(&entry))
+		str += pm8001_formatlog(&entry, str, PAGE_SIZE);
 	return str - buf;
 }
 
@@ -559,85 +589,349 @@ out:
 	return ret;
 }
 
+/*
+ * One flash update request: the ioctl payload and the fw_control_info
+ * that func_specific points at. The chunk itself stays in the mapped
+ * image. The retcode of a slot is FLASH_SLOT_IDLE, FLASH_SLOT_BUSY until
+ * the reply, or the FLASH_UPDATE_* status from the reply.
+ */
+#define FLASH_SLOT_SIZE	ALIGN(sizeof(struct pm8001_ioctl_payload) + \
+	sizeof(struct fw_control_info), 8)
+#define FLASH_SLOT_IDLE	0xFFFFFFFF
+#define FLASH_SLOT_BUSY	0xFFFFFFFE
+
+static struct fw_control_info *
+pm8001_flash_slot(u8 *slots, int i)
+{
+	struct pm8001_ioctl_payload *payload =
+		(struct pm8001_ioctl_payload *)(slots + i * FLASH_SLOT_SIZE);
+
+	return (struct fw_control_info *)payload->func_specific;
+}
+
+/*
+ * Retire a replied slot. Returns the error status if the firmware
+ * refused the chunk, 0 otherwise.
+ */
+static u32 pm8001_flash_retire(struct pm8001_hba_info *pm8001_ha,
+	struct fw_control_info *fwControl)
+{
+	u32 status = fwControl->retcode;
+
+	if ((status == FLASH_SLOT_IDLE) || (status == FLASH_SLOT_BUSY))
+		return 0;
+	fwControl->retcode = FLASH_SLOT_IDLE;
+	if (status > FLASH_UPDATE_IN_PROGRESS)
+		return status;
+	pm8001_ha->fw_flash_done += fwControl->len;
+	return 0;
+}
+
+/*
+ * An update in progress: the mapped image, the request slots, and once
+ * pm8001_update_flash gave up on it, the replies still owed.
+ */
+struct pm8001_flash_job {
+	struct sg_table		table;
+	u8			*slots;
+	const struct firmware	*fw_image;
+	int			inflight;
+};
+
+static void pm8001_flash_free(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_flash_job *job)
+{
+	dma_unmap_sg(pm8001_ha->dev, job->table.sgl, job->table.nents,
+		DMA_TO_DEVICE);
+	sg_free_table(&job->table);
+	PMFREE(job->slots, FLASH_SLOT_SIZE * FLASH_WINDOW);
+	release_firmware(job->fw_image);
+	PMFREE(job, sizeof(*job));
+}
+
+/*
+ * A reply did not come back in time. Forget the on-stack completion and
+ * detach the slots from the requests still out, so a late reply only
+ * frees its ccb. The firmware may still be reading the image for those,
+ * so the job takes the image over and is parked on the HBA until the
+ * last of them is back. Returns the number of requests still out.
+ */
+static int pm8001_flash_abandon(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_flash_job *job)
+{
+	struct pm8001_ccb_info *ccb;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	pm8001_ha->nvmd_completion = NULL;
+	FOR_ALL_CCB(ccb) {
+		u8 *fw_control;
+
+		if (!ccb->fw_control_context)
+			continue;
+		fw_control = (u8 *)ccb->fw_control_context->fw_control;
+		if ((fw_control >= job->slots) && (fw_control <
+		    job->slots + FLASH_SLOT_SIZE * FLASH_WINDOW)) {
+			ccb->fw_control_context->fw_control = NULL;
+			job->inflight++;
+		}
+	}
+	if (job->inflight) {
+		job->fw_image = pm8001_ha->fw_image;
+		pm8001_ha->fw_image = NULL;
+		pm8001_ha->flash_job = job;
+	}
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	return job->inflight;
+}
+
+/**
+ * pm8001_flash_late_reply - a reply pm8001_update_flash gave up on
+ * @pm8001_ha: our hba card information
+ *
+ * Called with pm8001_ha->lock held. The last one hands the parked job
+ * to pm8001_flash_reap_work, which can sleep.
+ */
+void pm8001_flash_late_reply(struct pm8001_hba_info *pm8001_ha)
+{
+	struct pm8001_flash_job *job = pm8001_ha->flash_job;
+
+	if (job && !--job->inflight)
+		schedule_work(&pm8001_ha->flash_reap_work);
+}
+
+static void pm8001_flash_release(struct pm8001_hba_info *pm8001_ha)
+{
+	struct pm8001_flash_job *job;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	job = pm8001_ha->flash_job;
+	pm8001_ha->flash_job = NULL;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	if (job)
+		pm8001_flash_free(pm8001_ha, job);
+}
+
+void pm8001_flash_reap_work(PMCS_WORK_ARG work)
+{
+	struct pm8001_hba_info *pm8001_ha = container_of(work,
+		struct pm8001_hba_info, flash_reap_work);
+
+	pm8001_flash_release(pm8001_ha);
+}
+
+/**
+ * pm8001_flash_reap - free a parked update whatever it still waits for
+ * @pm8001_ha: our hba card information
+ *
+ * Only once the chip was reset, so that nothing reads the image anymore.
+ */
+void pm8001_flash_reap(struct pm8001_hba_info *pm8001_ha)
+{
+	cancel_work_sync(&pm8001_ha->flash_reap_work);
+	pm8001_flash_release(pm8001_ha);
+}
+
+/*
+ * Map the image where request_firmware left it. The data is vmalloc'd (or
+ * built in), so it is described page by page and the DMA API is left to
+ * merge what it can. Returns the number of mapped entries, 0 on failure.
+ */
+static int pm8001_flash_map(struct pm8001_hba_info *pm8001_ha,
+	struct sg_table *table)
+{
+	const u8 *data = pm8001_ha->fw_image->data;
+	size_t left = pm8001_ha->fw_image->size;
+	int npages = DIV_ROUND_UP(offset_in_page(data) + left, PAGE_SIZE);
+	struct scatterlist *sg;
+	int i, nents;
+
+	if (sg_alloc_table(table, npages, GFP_KERNEL))
+		return 0;
+	for_each_sg(table->sgl, sg, npages, i) {
+		u32 off = offset_in_page(data);
+		u32 len = min_t(size_t, PAGE_SIZE - off, left);
+		struct page *page = is_vmalloc_addr(data) ?
+			vmalloc_to_page(data) : virt_to_page(data);
+
+		sg_set_page(sg, page, len, off);
+		data += len;
+		left -= len;
+	}
+	nents = dma_map_sg(pm8001_ha->dev, table->sgl, npages, DMA_TO_DEVICE);
+	if (!nents)
+		sg_free_table(table);
+	return nents;
+}
+
+/*
+ * The DMA address of image offset pos, and how many bytes from there on
+ * are contiguous. The cursor only moves forward, as the update does.
+ */
+static dma_addr_t pm8001_flash_dma(struct scatterlist **sgp, u32 *basep,
+	u32 pos, u32 *contig)
+{
+	struct scatterlist *sg = *sgp;
+
+	while (pos >= *basep + sg_dma_len(sg)) {
+		*basep += sg_dma_len(sg);
+		sg = sg_next(sg);
+	}
+	*sgp = sg;
+	*contig = *basep + sg_dma_len(sg) - pos;
+	return sg_dma_address(sg) + (pos - *basep);
+}
+
+/**
+ * pm8001_update_flash - send fw_image to the flash
+ * @pm8001_ha: our hba card information
+ *
+ * The image is DMA mapped in place, and each request's PRD points into
+ * the mapping; nothing is copied. Each partition is cut into pieces of
+ * at most FLASH_CHUNK_SIZE that do not cross a mapped segment. Up to
+ * FLASH_WINDOW of them are queued to the firmware at once, and every
+ * reply completes nvmd_completion. Stops issuing at the first error
+ * status and returns it once the requests in flight are back. A reply
+ * missing for FLASH_REPLY_TIMEOUT fails the update with FAIL_TIMEOUT,
+ * and the image then stays mapped until the stragglers are back.
+ */
 static int pm8001_update_flash(struct pm8001_hba_info *pm8001_ha)
 {
-	struct pm8001_ioctl_payload	*payload;
 	DECLARE_COMPLETION_ONSTACK(completion);
-	u8		*ioctlbuffer = NULL;
-	u32		length = 0;
-	struct fw_control_info	*fwControl;
-	u32		loopNumber, loopcount = 0;
+	struct pm8001_ioctl_payload *payload;
+	struct fw_control_info *fwControl;
+	struct pm8001_flash_job *job;
+	u8		*slots;
+	struct scatterlist *sg;
+	u32		sg_base = 0, contig;
+	int		nents;
+	u32		image_size = pm8001_ha->fw_image->size;
 	u32		sizeRead = 0;
-	u32		partitionSize, partitionSizeTmp;
+	u32		partitionSize, offset, len, rc;
 	u32		ret = 0;
-	u32		partitionNumber = 0;
-	struct pm8001_fw_image_header *image_hdr;
+	int		inflight = 0;
+	int		i;
 
-	length = 1024 * 16 + sizeof(*payload) - 1;
-	ioctlbuffer = PMALLOC(length, GFP_KERNEL);
-	image_hdr = (struct pm8001_fw_image_header *)pm8001_ha->fw_image->data;
-	if (!ioctlbuffer)
-		return -ENOMEM;
-	if (pm8001_ha->fw_image->size < 28) {
-		ret = FAIL_FILE_SIZE;
-		goto out;
+	if (image_size < HEADER_LEN)
+		return FAIL_FILE_SIZE;
+	job = PMALLOC(sizeof(*job), GFP_KERNEL);
+	if (!job)
+		return FAIL_OUT_MEMORY;
+	slots = PMALLOC(FLASH_SLOT_SIZE * FLASH_WINDOW, GFP_KERNEL);
+	if (!slots) {
+		PMFREE(job, sizeof(*job));
+		return FAIL_OUT_MEMORY;
+	}
+	nents = pm8001_flash_map(pm8001_ha, &job->table);
+	if (!nents) {
+		PMFREE(slots, FLASH_SLOT_SIZE * FLASH_WINDOW);
+		PMFREE(job, sizeof(*job));
+		return FAIL_OUT_MEMORY;
+	}
+	job->slots = slots;
+	sg = job->table.sgl;
+	for (i = 0; i < FLASH_WINDOW; i++) {
+		payload = (struct pm8001_ioctl_payload *)
+			(slots + i * FLASH_SLOT_SIZE);
+		payload->func_specific = (u8 *)(payload + 1);
+		pm8001_flash_slot(slots, i)->retcode = FLASH_SLOT_IDLE;
 	}
+	pm8001_ha->fw_flash_done = 0;
+	pm8001_ha->fw_flash_total = image_size;
+	pm8001_ha->nvmd_completion = &completion;
+
+	while ((sizeRead < image_size) && !ret) {
+		struct pm8001_fw_image_header *image_hdr =
+			(struct pm8001_fw_image_header *)
+			(pm8001_ha->fw_image->data + sizeRead);
+
+		if ((image_size - sizeRead) < HEADER_LEN) {
+			ret = FAIL_FILE_SIZE;
+			break;
+		}
+		partitionSize = be32_to_cpu(image_hdr->image_length)
+			+ HEADER_LEN;
+		if (partitionSize > (image_size - sizeRead)) {
+			ret = FAIL_FILE_SIZE;
+			break;
+		}
+		for (offset = 0; offset < partitionSize; offset += len) {
+			/* wait for a reply while the window is full */
+			if (inflight == FLASH_WINDOW) {
+				if (!wait_for_completion_timeout(&completion,
+						FLASH_REPLY_TIMEOUT)) {
+					ret = FAIL_TIMEOUT;
+					break;
+				}
+				inflight--;
+			}
+			fwControl = NULL;
+			for (i = 0; i < FLASH_WINDOW; i++) {
+				rc = pm8001_flash_retire(pm8001_ha,
+					pm8001_flash_slot(slots, i));
+				if (rc && !ret)
+					ret = rc;
+				if (!fwControl && (pm8001_flash_slot(slots,
+				    i)->retcode == FLASH_SLOT_IDLE))
+					fwControl = pm8001_flash_slot(slots, i);
+			}
+			if (!fwControl && !ret)
+				ret = FAIL_PARAMETERS;
+			if (ret)
+				break;
 
-	while (sizeRead < pm8001_ha->fw_image->size) {
-		partitionSizeTmp =
-			*(u32 *)((u8 *)&image_hdr->image_length + sizeRead);
-		partitionSize = be32_to_cpu(partitionSizeTmp);
-		loopcount = (partitionSize + HEADER_LEN)/IOCTL_BUF_SIZE;
-		if (loopcount % IOCTL_BUF_SIZE)
-			loopcount++;
-		if (loopcount == 0)
-			loopcount++;
-		for (loopNumber = 0; loopNumber < loopcount; loopNumber++) {
-			payload = (struct pm8001_ioctl_payload *)ioctlbuffer;
-			payload->length = 1024*16;
+			payload = (struct pm8001_ioctl_payload *)
+				((u8 *)fwControl - sizeof(*payload));
+			payload->func_dma = pm8001_flash_dma(&sg, &sg_base,
+				sizeRead + offset, &contig);
+			len = min_t(u32, partitionSize - offset,
+				FLASH_CHUNK_SIZE);
+			len = min_t(u32, len, contig);
+			payload->length = len;
 			payload->id = 0;
-			fwControl =
-			      (struct fw_control_info *)payload->func_specific;
-			fwControl->len = IOCTL_BUF_SIZE;   /* IN */
-			fwControl->size = partitionSize + HEADER_LEN;/* IN */
-			fwControl->retcode = 0;/* OUT */
-			fwControl->offset = loopNumber * IOCTL_BUF_SIZE;/*OUT */
-
-		/* for the last chunk of data in case file size is not even with
-		4k, load only the rest*/
-		if (((loopcount-loopNumber) == 1) &&
-			((partitionSize + HEADER_LEN) % IOCTL_BUF_SIZE)) {
-			fwControl->len =
-				(partitionSize + HEADER_LEN) % IOCTL_BUF_SIZE;
-			memcpy((u8 *)fwControl->buffer,
-				(u8 *)pm8001_ha->fw_image->data + sizeRead,
-				(partitionSize + HEADER_LEN) % IOCTL_BUF_SIZE);
-			sizeRead +=
-				(partitionSize + HEADER_LEN) % IOCTL_BUF_SIZE;
-		} else {
-			memcpy((u8 *)fwControl->buffer,
-				(u8 *)pm8001_ha->fw_image->data + sizeRead,
-				IOCTL_BUF_SIZE);
-			sizeRead += IOCTL_BUF_SIZE;
+			fwControl->len = len;			/* IN */
+			fwControl->size = partitionSize;	/* IN */
+			fwControl->offset = offset;		/* IN */
+			/* the reply replaces this with its status */
+			fwControl->retcode = FLASH_SLOT_BUSY;
+			if (PM8001_CHIP_DISP->fw_flash_update_req(pm8001_ha,
+					payload)) {
+				fwControl->retcode = FLASH_SLOT_IDLE;
+				ret = FAIL_OUT_MEMORY;
+				break;
+			}
+			inflight++;
 		}
+		sizeRead += partitionSize;
+	}
 
-		pm8001_ha->nvmd_completion = &completion;
-		ret = PM8001_CHIP_DISP->fw_flash_update_req(pm8001_ha, payload);
-		wait_for_completion(&completion);
-		if (ret || (fwControl->retcode > FLASH_UPDATE_IN_PROGRESS)) {
-			ret = fwControl->retcode;
-			PMFREE(ioctlbuffer, length);
-			ioctlbuffer = NULL;
+	/* drain, keeping the first error */
+	while (inflight && (ret != FAIL_TIMEOUT)) {
+		if (!wait_for_completion_timeout(&completion,
+				FLASH_REPLY_TIMEOUT)) {
+			ret = FAIL_TIMEOUT;
 			break;
 		}
+		inflight--;
 	}
-	if (ret)
-		break;
-	partitionNumber++;
-}
-out:
-	if (ioctlbuffer)
-		PMFREE(ioctlbuffer, length);
+	if (ret == FAIL_TIMEOUT) {
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("flash update: %d replies lost\n",
+			inflight));
+		if (pm8001_flash_abandon(pm8001_ha, job))
+			return ret;
+	} else {
+		for (i = 0; i < FLASH_WINDOW; i++) {
+			rc = pm8001_flash_retire(pm8001_ha,
+				pm8001_flash_slot(slots, i));
+			if (rc && !ret)
+				ret = rc;
+		}
+	}
+	pm8001_ha->nvmd_completion = NULL;
+	pm8001_flash_free(pm8001_ha, job);
 	return ret;
 }
 static ssize_t pm8001_store_update_fw(struct PMCS_SYSFS_DEV *cdev,
@@ -680,7 +974,9 @@ static ssize_t pm8001_store_update_fw(struct PMCS_SYSFS_DEV *cdev,
 		goto out1;
 	}
 
-	if (pm8001_ha->fw_status == FLASH_IN_PROGRESS) {
+	/* also while an abandoned update still holds the flash */
+	if ((pm8001_ha->fw_status == FLASH_IN_PROGRESS) ||
+	    pm8001_ha->flash_job) {
 		err = FLASH_IN_PROGRESS;
 		goto out1;
 	}
@@ -736,6 +1032,12 @@ static ssize_t pm8001_show_update_fw(struct PMCS_SYSFS_DEV *cdev,
 	}
 	if (pm8001_ha->fw_status != FLASH_IN_PROGRESS)
 		pm8001_ha->fw_status = FLASH_OK;
+	else
+		return snprintf(buf, PAGE_SIZE, "status=%x %s %u/%u\n",
+			flash_error_table[i].err_code,
+			flash_error_table[i].reason,
+			pm8001_ha->fw_flash_done,
+			pm8001_ha->fw_flash_total);
 
 	return snprintf(buf, PAGE_SIZE, "status=%x %s\n",
 			flash_error_table[i].err_code,
@@ -744,6 +1046,29 @@ static ssize_t pm8001_show_update_fw(struct PMCS_SYSFS_DEV *cdev,
 
 static PMCS_DEVICE_ATTR(update_fw, S_IRUGO|S_IWUSR|S_IWGRP,
 	pm8001_show_update_fw, pm8001_store_update_fw);
+
+/**
+ * pm8001_ctl_hda_fw_retry_store - look for the HDA boot images again
+ * @cdev: pointer to embedded class device
+ * @buf: "1"
+ * @count: the length of @buf
+ *
+ * A sysfs 'write-only' shost attribute. Image files found missing are
+ * not asked for again on each reset; once they have been installed,
+ * writing 1 makes the next HDA boot request them.
+ */
+static ssize_t pm8001_ctl_hda_fw_retry_store(struct PMCS_SYSFS_DEV *cdev,
+	PMCS_ATTR_ARG const char *buf, size_t count)
+{
+	int val = 0;
+
+	if ((sscanf(buf, "%d", &val) != 1) || (val != 1))
+		return -EINVAL;
+	pm8001_hda_fw_retry();
+	return count;
+}
+static PMCS_DEVICE_ATTR(hda_fw_retry, S_IWUSR, NULL,
+	pm8001_ctl_hda_fw_retry_store);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19)
 struct PMCS_SYSFS_DEV_ATTR *pm8001_host_attrs[] = {
 	&class_device_attr_interface_rev,
@@ -761,6 +1086,8 @@ struct PMCS_SYSFS_DEV_ATTR *pm8001_host_attrs[] = {
 	&class_device_attr_sas_spec_support,
 	&class_device_attr_logging_level,
 	&class_device_attr_host_sas_address,
+	&class_device_attr_init_timings,
+	&class_device_attr_hda_fw_retry,
 	NULL,
 };
 #else
@@ -778,7 +1105,91 @@ struct PMCS_SYSFS_DEV_ATTR *pm8001_host_attrs[] = {
 	&dev_attr_sas_spec_support,
 	&dev_attr_logging_level,
 	&dev_attr_host_sas_address,
+	&dev_attr_init_timings,
+	&dev_attr_hda_fw_retry,
 	NULL,
 };
+
+
+/* scsi device attributes */
+
+/**
+ * pm8001_ctl_ncq_stats_show - NCQ tag use of a SATA device
+ * @cdev: pointer to embedded class device
+ * @buf: the buffer returned
+ *
+ * A sysfs 'read-only' sdev attribute. avg_active is the number of tags
+ * outstanding as seen by each NCQ command on its way out.
+ */
+static ssize_t pm8001_ctl_ncq_stats_show(struct device *cdev,
+	struct device_attribute *attr, char *buf)
+{
+	struct scsi_device *sdev = to_scsi_device(cdev);
+	struct domain_device *dev = sdev_to_domain_dev(sdev);
+	struct pm8001_hba_info *pm8001_ha = pm8001_find_ha_by_dev(dev);
+	struct pm8001_device *pm8001_dev;
+	u32 active, peak, avg = 0;
+	u64 cmds, sum, non_ncq;
+	unsigned long flags;
+
+	if (!dev_is_sata(dev))
+		return -EINVAL;
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	pm8001_dev = dev->lldd_dev;
+	if (!pm8001_dev) {
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		return -ENODEV;
+	}
+	active = hweight32(pm8001_dev->ncq_tags);
+	peak = pm8001_dev->ncq_peak;
+	cmds = pm8001_dev->ncq_cmds;
+	sum = pm8001_dev->ncq_active_sum;
+	non_ncq = pm8001_dev->non_ncq_cmds;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+
+	if (cmds)
+		avg = div64_u64(sum * 100, cmds);
+	return snprintf(buf, PAGE_SIZE, "depth %d\nactive %u\npeak %u\n"
+		"ncq_cmds %llu\navg_active %u.%02u\nnon_ncq_cmds %llu\n",
+		sdev->queue_depth, active, peak, (unsigned long long)cmds,
+		avg / 100, avg % 100,
+		(unsigned long long)non_ncq);
+}
+static DEVICE_ATTR(ncq_stats, S_IRUGO, pm8001_ctl_ncq_stats_show, NULL);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+/* ncq_stats only shows up on SATA devices */
+static umode_t pm8001_sdev_attr_is_visible(struct kobject *kobj,
+	struct attribute *attr, int i)
+{
+	struct scsi_device *sdev = to_scsi_device(kobj_to_dev(kobj));
+
+	if ((attr == &dev_attr_ncq_stats.attr) &&
+	    !dev_is_sata(sdev_to_domain_dev(sdev)))
+		return 0;
+	return attr->mode;
+}
+
+static struct attribute *pm8001_sdev_attrs[] = {
+	&dev_attr_ncq_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group pm8001_sdev_attr_group = {
+	.attrs = pm8001_sdev_attrs,
+	.is_visible = pm8001_sdev_attr_is_visible,
+};
+
+const struct attribute_group *pm8001_sdev_groups[] = {
+	&pm8001_sdev_attr_group,
+	NULL,
+};
+#else
+/* every device gets ncq_stats, it fails with -EINVAL on non-SATA ones */
+struct device_attribute *pm8001_sdev_attrs[] = {
+	&dev_attr_ncq_stats,
+	NULL,
+};
+#endif
 #endif
 
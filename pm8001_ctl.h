@@ -44,6 +44,9 @@
 #define PM8001_CTL_H_INCLUDED
 
 #define IOCTL_BUF_SIZE		4096
+#define FLASH_CHUNK_SIZE	(16 * 1024)	/* image bytes per request */
+#define FLASH_WINDOW		4	/* requests in flight */
+#define FLASH_REPLY_TIMEOUT	(60 * HZ)	/* for one FW_FLASH_UPDATE reply */
 #define HEADER_LEN			28
 #define SIZE_OFFSET			16
 
@@ -53,6 +56,7 @@
 #define FAIL_FILE_SIZE                  0x000a00
 #define FAIL_PARAMETERS                 0x000b00
 #define FAIL_OUT_MEMORY                 0x000c00
+#define FAIL_TIMEOUT                    0x000d00
 #define FLASH_IN_PROGRESS               0x001000
 
 #endif /* PM8001_CTL_H_INCLUDED */
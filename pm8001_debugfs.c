@@ -41,7 +41,11 @@
 #include "pm8001_sas.h"
 #include <linux/debugfs.h>
 #include <linux/err.h>
+#include <linux/mm.h>
 #include <linux/nmi.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/vmalloc.h>
 #include <linux/version.h>
 #if LINUX_VERSION_CODE <= KERNEL_VERSION(2, 6, 32)
 #ifndef IS_ERR_OR_NULL
@@ -64,9 +68,19 @@
 static int pm8001_debugfs_enable = 1;
 module_param_named(debugfs_enable, pm8001_debugfs_enable, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(debugfs_enable, "Enable debugfs sevices");
+static int pm8001_debugfs_gsm_snapshot;
+module_param_named(debugfs_gsm_snapshot, pm8001_debugfs_gsm_snapshot, int,
+	S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(debugfs_gsm_snapshot,
+	"Copy a whole gsm_memory region when it is opened");
 
 /* Debug File System Platform Base Class Functions */
 
+struct pm8001_debugfs_forensic_mem_list {
+	loff_t offset;
+	size_t size;
+};
+
 struct pm8001_debug {
 	struct debugfs_blob_wrapper blob;
 	union { /* Mutually Exclusive */
@@ -74,9 +88,56 @@ struct pm8001_debug {
 		unsigned long offset;
 	} allocation;
 	ssize_t (*write)(struct file *file, loff_t pos, size_t nbytes);
+	void *bounce; /* gsm_memory window copy or snapshot */
+	int snapshot; /* bounce holds the whole region */
+	/* Deferred rendering, NULL once the blob is complete */
+	int (*fill)(struct pm8001_debug *debug, loff_t end);
+	struct mutex fill_mutex;
+	struct pm8001_hba_info *pm8001_ha;
+	struct pm8001_debugfs_forensic_mem_list *(*function)(
+		struct pm8001_debugfs_forensic_mem_list *);
+	struct pm8001_debugfs_forensic_mem_list *next; /* list to render */
+	struct pm8001_debugfs_forensic_mem_list entry; /* generator state */
+	int arg; /* bar, or queue region index */
+	int raw; /* opened through the .bin node, dwords are not rendered */
+	unsigned item, item_end; /* next and last + 1 IOMB to render */
 	char buffer[0];
 };
 
+/*
+ *	pm8001_debugfs_fill - Render a lazily populated file
+ *	@debug: The file data
+ *	@end: The offset the caller needs rendered
+ *
+ *	Description:
+ *	Files opened with a fill routine render (and read the hardware) only
+ *	up to the furthest offset accessed so far, in order, like seq_file.
+ *	What is rendered stays cached for the life of the open file. Once
+ *	pm8001_debugfs_terminate() ran, the hardware may be gone and nothing
+ *	more is rendered.
+ *
+ *	Returns:
+ *	zero or a negative error.
+ */
+static int
+pm8001_debugfs_fill(struct pm8001_debug *debug, loff_t end)
+{
+	struct pm8001_hba_info *pm8001_ha = debug->pm8001_ha;
+	int rc = 0;
+
+	if (!debug->fill)
+		return 0;
+	mutex_lock(&debug->fill_mutex);
+	down_read(&pm8001_ha->debugfs_sem);
+	if (pm8001_ha->debugfs_gone)
+		rc = -ENODEV;
+	else if (debug->fill && (debug->blob.size < end))
+		rc = debug->fill(debug, end);
+	up_read(&pm8001_ha->debugfs_sem);
+	mutex_unlock(&debug->fill_mutex);
+	return rc;
+}
+
 /*
  *	pm8001_debugfs_lseek - Seek through a debugfs file
  *	@file: The file pointer to attach the feature.
@@ -99,6 +160,7 @@ pm8001_debugfs_lseek(struct file *file, loff_t off, int whence)
 {
 	struct pm8001_debug *debug;
 	loff_t pos = -1;
+	int rc;
 
 	debug = file->private_data;
 
@@ -110,8 +172,14 @@ pm8001_debugfs_lseek(struct file *file, loff_t off, int whence)
 		pos = file->f_pos + off;
 		break;
 	case 2:
+		rc = pm8001_debugfs_fill(debug, LLONG_MAX);
+		if (rc < 0)
+			return rc;
 		pos = debug->blob.size - off;
 	}
+	rc = pm8001_debugfs_fill(debug, pos);
+	if (rc < 0)
+		return rc;
 	return (pos < 0 || pos > debug->blob.size) ?
 		-EINVAL :
 		(file->f_pos = pos);
@@ -142,8 +210,12 @@ pm8001_debugfs_read(
 	loff_t *ppos)
 {
 	struct pm8001_debug *debug;
+	int rc;
 
 	debug = file->private_data;
+	rc = pm8001_debugfs_fill(debug, *ppos + nbytes);
+	if (rc < 0)
+		return rc;
 
 	return simple_read_from_buffer(buf, nbytes, ppos, debug->blob.data,
 					debug->blob.size);
@@ -223,6 +295,180 @@ pm8001_debugfs_release(struct inode *inode, struct file *file)
 	return 0;
 }
 
+/*
+ *	pm8001_debugfs_hba_release - Release a file that holds the hba
+ *	@inode: The inode pointer
+ *	@file: The file pointer to attach the feature.
+ *
+ *	Description:
+ *	Nodes that go back to the hba after open, to render, write or map,
+ *	hold its structure from open on; see pm8001_debugfs_put().
+ */
+static int
+pm8001_debugfs_hba_release(struct inode *inode, struct file *file)
+{
+	struct pm8001_debug *debug = file->private_data;
+	struct pm8001_hba_info *pm8001_ha = debug->pm8001_ha;
+
+	pm8001_debugfs_release(inode, file);
+	pm8001_debugfs_put(pm8001_ha);
+	return 0;
+}
+
+/*
+ *	pm8001_debugfs_is_bin - Was the node opened through its .bin name
+ *	@file: The file pointer
+ */
+static int
+pm8001_debugfs_is_bin(struct file *file)
+{
+	const char *name = (const char *)file->f_dentry->d_name.name;
+	size_t len = strlen(name);
+
+	return (len > (sizeof(".bin") - 1)) &&
+		(strcmp(name + len - (sizeof(".bin") - 1), ".bin") == 0);
+}
+
+/*
+ *	pm8001_debugfs_region_vm_open - Account for a copied region mapping
+ *	@vma: The mapping
+ *
+ *	Description:
+ *	A mapping holds the hba structure, which it may outlive once
+ *	pm8001_debugfs_revoke() emptied it.
+ */
+static void
+pm8001_debugfs_region_vm_open(struct vm_area_struct *vma)
+{
+	struct pm8001_hba_info *pm8001_ha = vma->vm_private_data;
+
+	atomic_inc(&pm8001_ha->debugfs_mmaps);
+	atomic_inc(&pm8001_ha->debugfs_users);
+}
+
+/*
+ *	pm8001_debugfs_region_vm_close - Drop a region mapping
+ *	@vma: The mapping
+ */
+static void
+pm8001_debugfs_region_vm_close(struct vm_area_struct *vma)
+{
+	struct pm8001_hba_info *pm8001_ha = vma->vm_private_data;
+
+	atomic_dec(&pm8001_ha->debugfs_mmaps);
+	pm8001_debugfs_put(pm8001_ha);
+}
+
+static const struct vm_operations_struct pm8001_debugfs_region_vm_ops = {
+	.open =  pm8001_debugfs_region_vm_open,
+	.close = pm8001_debugfs_region_vm_close,
+};
+
+struct pm8001_debugfs_mapped {
+	struct list_head list;
+	struct inode *inode;
+};
+
+/*
+ *	pm8001_debugfs_region_track - Remember a node that has mappings
+ *	@pm8001_ha: The hba owning the region
+ *	@inode: The node being mapped
+ *
+ *	Description:
+ *	Called with debugfs_map_mutex held. The inode is held until
+ *	pm8001_debugfs_revoke() has emptied its mappings.
+ *
+ *	Returns:
+ *	zero or a negative error.
+ */
+static int
+pm8001_debugfs_region_track(
+	struct pm8001_hba_info *pm8001_ha,
+	struct inode *inode)
+{
+	struct pm8001_debugfs_mapped *mapped;
+
+	list_for_each_entry(mapped, &pm8001_ha->debugfs_mapped, list)
+		if (mapped->inode == inode)
+			return 0;
+	mapped = kmalloc(sizeof(*mapped), GFP_KERNEL);
+	if (!mapped)
+		return -ENOMEM;
+	mapped->inode = igrab(inode);
+	if (!mapped->inode) {
+		kfree(mapped);
+		return -ENODEV;
+	}
+	list_add(&mapped->list, &pm8001_ha->debugfs_mapped);
+	return 0;
+}
+
+/*
+ *	pm8001_debugfs_region_mmap - Map a host memory region into user space
+ *	@pm8001_ha: The hba owning the region
+ *	@ind: memoryMap region index
+ *	@vma: The mapping requested by the caller
+ *
+ *	Description:
+ *	This routine backs the debugfs mmap file operation for nodes whose
+ *	data lives in coherent host memory shared with the chip. The mapping
+ *	starts at the beginning of the allocation, which is page aligned so
+ *	the region itself starts at offset zero. Mappings are read only, and
+ *	cannot be made writable later through mprotect(). They are counted so
+ *	that the event logs are not reallocated underneath them, and the node
+ *	is remembered so that removing the HBA can empty them before the
+ *	regions are freed; an access after that raises SIGBUS.
+ *
+ *	Returns:
+ *	zero or a negative error.
+ */
+static int
+pm8001_debugfs_region_mmap(
+	struct pm8001_hba_info *pm8001_ha,
+	int ind,
+	struct vm_area_struct *vma)
+{
+	struct mpi_mem *region = &pm8001_ha->memoryMap.region[ind];
+	unsigned long pages, size;
+	int rc;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	mutex_lock(&pm8001_ha->debugfs_map_mutex);
+	rc = -ENODEV;
+	if (pm8001_ha->debugfs_revoked || !region->real_addr)
+		goto out;
+	pages = PAGE_ALIGN(region->real_len) >> PAGE_SHIFT;
+	size = (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
+	rc = -EINVAL;
+	if ((vma->vm_pgoff >= pages) || (size > (pages - vma->vm_pgoff)))
+		goto out;
+	rc = pm8001_debugfs_region_track(pm8001_ha,
+		vma->vm_file->f_dentry->d_inode);
+	if (rc)
+		goto out;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0)
+	/* dma_mmap_coherent() applies vm_pgoff itself */
+	rc = dma_mmap_coherent(&pm8001_ha->pdev->dev, vma, region->real_addr,
+		region->phys_addr, region->real_len);
+#else
+	rc = remap_pfn_range(vma, vma->vm_start,
+		(virt_to_phys(region->real_addr) >> PAGE_SHIFT) +
+			vma->vm_pgoff,
+		vma->vm_end - vma->vm_start, vma->vm_page_prot);
+#endif
+	if (rc)
+		goto out;
+	vma->vm_private_data = pm8001_ha;
+	vma->vm_ops = &pm8001_debugfs_region_vm_ops;
+	pm8001_debugfs_region_vm_open(vma);
+out:
+	mutex_unlock(&pm8001_ha->debugfs_map_mutex);
+	return rc;
+}
+
 struct pm8001_header_operations {
 	const char name[15]; /* MAKE SURE THIS IS LARGE ENOUGH */
 	const unsigned char type;
@@ -230,6 +476,7 @@ struct pm8001_header_operations {
 #define PM8001_OP_FILE_RO  1
 #define PM8001_OP_FILE_RW  2
 #define PM8001_OP_WRAP     3
+#define PM8001_OP_FILE_BIN 4 /* read only, plus a raw name.bin sibling */
 };
 
 struct pm8001_file_operations {
@@ -279,19 +526,21 @@ pm8001_debugfs_build_tree(
 	const struct pm8001_file_operations *fop;
 	const struct pm8001_dir_operations *dop;
 	const struct pm8001_wrap_operations *wop;
+	char bin_name[sizeof(op->name) + sizeof(".bin")];
 	char *new_path;
 	int i, rc = -EINVAL;
 
 	switch (op->type) {
 	case PM8001_OP_FILE_RO:
 	case PM8001_OP_FILE_RW:
+	case PM8001_OP_FILE_BIN:
 		rc = 0;
 		fop = (const struct pm8001_file_operations *)op;
 		entry = debugfs_create_file(
 			fop->header.name,
-			((fop->header.type == PM8001_OP_FILE_RO) ?
-			 (S_IFREG|S_IRUGO) :
-			 (S_IFREG|S_IRUGO|S_IWUSR)),
+			((fop->header.type == PM8001_OP_FILE_RW) ?
+			 (S_IFREG|S_IRUGO|S_IWUSR) :
+			 (S_IFREG|S_IRUGO)),
 			root, root, &fop->fop);
 		if (IS_ERR_OR_NULL(entry)) {
 			pm8001_printk("Cannot create %s/%s\n",
@@ -302,6 +551,22 @@ pm8001_debugfs_build_tree(
 			break;
 		}
 		entry->d_fsdata = pm8001_ha;
+		if (fop->header.type != PM8001_OP_FILE_BIN)
+			break;
+		/* Same operations, the open tells the two apart by name */
+		snprintf(bin_name, sizeof(bin_name), "%s.bin",
+			fop->header.name);
+		entry = debugfs_create_file(bin_name, (S_IFREG|S_IRUGO),
+			root, root, &fop->fop);
+		if (IS_ERR_OR_NULL(entry)) {
+			pm8001_printk("Cannot create %s/%s\n",
+				path, bin_name);
+			rc = PTR_ERR(entry);
+			if (!rc)
+				rc = -EBADF;
+			break;
+		}
+		entry->d_fsdata = pm8001_ha;
 		break;
 	case PM8001_OP_DIR:
 		rc = 0;
@@ -349,6 +614,59 @@ pm8001_debugfs_build_tree(
 
 /* 1.gsm_memory */
 
+/*
+ *	pm8001_debugfs_gsm_copy - Copy GSM through the BAR 2 window
+ *	@pm8001_ha: The hba to read from
+ *	@to: Destination buffer
+ *	@addr: GSM address to start at
+ *	@len: Number of bytes
+ *
+ *	Description:
+ *	Copies a whole 64KB window at a time under bar4_mutex. The host lock
+ *	is not taken, so I/O completions carry on while the copy runs.
+ *
+ *	Returns:
+ *	zero, -EIO if the window could not be moved, or -ENODEV once
+ *	pm8001_debugfs_terminate() ran.
+ */
+static int
+pm8001_debugfs_gsm_copy(
+	struct pm8001_hba_info *pm8001_ha,
+	void *to,
+	u32 addr,
+	size_t len)
+{
+	int rc = 0;
+
+	down_read(&pm8001_ha->debugfs_sem);
+	if (pm8001_ha->debugfs_gone) {
+		up_read(&pm8001_ha->debugfs_sem);
+		return -ENODEV;
+	}
+	mutex_lock(&pm8001_ha->bar4_mutex);
+	while (len) {
+		u32 offset = addr & 0xFFFF;
+		size_t xfer = 0x0010000 - offset;
+
+		if (xfer > len)
+			xfer = len;
+		if (-1 == pm8001_bar4_shift(pm8001_ha, addr & 0xFFFF0000)) {
+			rc = -EIO;
+			break;
+		}
+		memcpy_fromio(to,
+			(char __iomem *)pm8001_ha->io_mem[2].memvirtaddr
+				+ offset, xfer);
+		to += xfer;
+		addr += xfer;
+		len -= xfer;
+	}
+	pm8001_bar4_shift(pm8001_ha, 0);
+	mutex_unlock(&pm8001_ha->bar4_mutex);
+	up_read(&pm8001_ha->debugfs_sem);
+	return rc;
+}
+
 /*
  *	pm8001_debugfs_forensic_gsm_memory_read - Read a gms memory from window
  *	@file: The file pointer to attach the feature.
@@ -376,74 +694,70 @@ pm8001_debugfs_forensic_gsm_memory_read(
 	loff_t *ppos)
 {
 	struct pm8001_debug *debug = file->private_data;
-	struct pm8001_hba_info *pm8001_ha;
-	char * cp;
+	struct pm8001_hba_info *pm8001_ha = debug->blob.data;
 	ssize_t retval = 0;
 	size_t size = debug->blob.size;
 
+	if (debug->snapshot)
+		return simple_read_from_buffer(buf, nbytes, ppos,
+			debug->bounce, size);
+
 	if (size < *ppos)
 		return retval;
-
 	size -= *ppos;
-	pm8001_ha = debug->blob.data;
-	cp = pm8001_ha->io_mem[2].memvirtaddr;
-
-	while (nbytes) {
-		unsigned long flags;
-		int err;
-		ssize_t rc = -EFAULT;
-		u32 shift = (debug->allocation.offset + *ppos) & 0xFFFF0000;
-		u32 offset = (debug->allocation.offset + *ppos) & 0xFFFF;
-		size_t xfer = 0x0010000 - offset;
-		const size_t max_xfer = 1024;
 
-		if (xfer > max_xfer)
-			xfer = max_xfer;
+	while (nbytes && size) {
+		u32 addr = debug->allocation.offset + *ppos;
+		size_t xfer = 0x0010000 - (addr & 0xFFFF);
+		int rc;
+
 		if (xfer > nbytes)
 			xfer = nbytes;
 		if (xfer > size)
 			xfer = size;
 
-		if (xfer == 0)
-			break;
-
-		while (unlikely(!spin_trylock_irqsave(&pm8001_ha->lock,
-							flags))) {
-			yield();
-			touch_nmi_watchdog();
-		}
-		err = pm8001_bar4_shift(pm8001_ha, shift);
-		
-		if (-1 != err) {
-			loff_t position = 0;
-			rc = simple_read_from_buffer(buf, xfer,
-				&position, cp + offset, xfer);
-		}
-
-		pm8001_bar4_shift(pm8001_ha, 0);
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-		/* Be nice */
-                yield();
-
-		if (-1 == err)
-			break;
-
-		if (rc <= 0) {
+		rc = pm8001_debugfs_gsm_copy(pm8001_ha, debug->bounce,
+			addr, xfer);
+		if (!rc && copy_to_user(buf, debug->bounce, xfer))
+			rc = -EFAULT;
+		if (rc) {
 			if (retval == 0)
 				retval = rc;
 			break;
 		}
 
-		retval += rc;
-		*ppos += rc;
-		buf += rc;
-		cp += rc;
-		nbytes -= rc;
-		size -= rc;
+		retval += xfer;
+		*ppos += xfer;
+		buf += xfer;
+		nbytes -= xfer;
+		size -= xfer;
+		cond_resched();
 	}
 	return retval;
 }
 
+/*
+ *	pm8001_debugfs_forensic_gsm_memory_release - Release a gsm memory file
+ *	@inode: The inode pointer
+ *	@file: The file pointer to attach the gsm memory
+ *
+ *	Description:
+ *	Frees the window copy or snapshot along with the file data.
+ */
+static int
+pm8001_debugfs_forensic_gsm_memory_release(
+	struct inode *inode,
+	struct file *file)
+{
+	struct pm8001_debug *debug = file->private_data;
+	struct pm8001_hba_info *pm8001_ha = debug->blob.data;
+
+	vfree(debug->bounce);
+	pm8001_debugfs_release(inode, file);
+	pm8001_debugfs_put(pm8001_ha);
+	return 0;
+}
+
 /*
  *	pm8001_debugfs_forensic_gsm_memory_open - Open the gsm memory
  *	@inode: The inode pointer
@@ -478,6 +792,25 @@ pm8001_debugfs_forensic_gsm_memory_open(
 	pm8001_ha = parent->d_fsdata;
 	debug->blob.data = pm8001_ha; /* HBA */
 	debug->write = NULL;
+	debug->fill = NULL;
+	debug->snapshot = pm8001_debugfs_gsm_snapshot;
+	/* a snapshot of the region, or room for one window */
+	debug->bounce = vmalloc(debug->snapshot ?
+		size : min_t(size_t, size, 0x0010000));
+	if (!debug->bounce) {
+		kfree(debug);
+		goto out;
+	}
+	if (debug->snapshot) {
+		rc = pm8001_debugfs_gsm_copy(pm8001_ha, debug->bounce,
+			off, size);
+		if (rc) {
+			vfree(debug->bounce);
+			kfree(debug);
+			goto out;
+		}
+	}
+	atomic_inc(&pm8001_ha->debugfs_users);
 	file->private_data = debug;
 
 	rc = 0;
@@ -516,7 +849,7 @@ pm8001_debugfs_forensic_op_gsm_memory_io_status = {
 		.open =	   pm8001_debugfs_forensic_gsm_memory_io_status_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_forensic_gsm_memory_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_forensic_gsm_memory_release,
 	}
 };
 
@@ -551,7 +884,7 @@ pm8001_debugfs_forensic_op_gsm_memory_rb_storage = {
 		.open =	   pm8001_debugfs_forensic_gsm_memory_rb_storage_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_forensic_gsm_memory_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_forensic_gsm_memory_release,
 	}
 };
 
@@ -586,7 +919,7 @@ pm8001_debugfs_forensic_op_gsm_memory_rb_pointers = {
 		.open =	   pm8001_debugfs_forensic_gsm_memory_rb_pointers_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_forensic_gsm_memory_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_forensic_gsm_memory_release,
 	}
 };
 
@@ -621,7 +954,7 @@ pm8001_debugfs_forensic_op_gsm_memory_rb_configure = {
 		.open =	   pm8001_debugfs_forensic_gsm_memory_rb_configure_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_forensic_gsm_memory_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_forensic_gsm_memory_release,
 	}
 };
 
@@ -656,7 +989,7 @@ pm8001_debugfs_forensic_op_gsm_memory_gsm_sm = {
 		.open =	   pm8001_debugfs_forensic_gsm_memory_gsm_sm_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_forensic_gsm_memory_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_forensic_gsm_memory_release,
 	}
 };
 
@@ -739,24 +1072,26 @@ pm8001_debugfs_forensic_queue_cipi_open(
 	debug->blob.data = debug->buffer;
 	debug->blob.size = 0;
 	debug->write = NULL;
+	debug->fill = NULL;
 
 	for (i = 0; i < num; ++i) {
 		/* For i'th queue */
-		ind = IB + i;
+		u32 val;
+
 		if (strncmp(parent->d_name.name, "oq", 2) == 0)
-			ind += OB - IB;
-
-		debug->blob.size += snprintf(debug->buffer,
-		debug->allocation.size,
-		"[0x%04x] : 0x%x\n",
-		i,
-		((strncmp(file->f_dentry->d_name.name, "ci", 2) == 0) ?
-		(((OB > IB) ? (ind < OB) : (ind >= IB)) ?
-		 *((uint32_t *)(pm8001_ha->memoryMap.region[CI].virt_ptr)) :
-		 pm8001_ha->outbnd_q_tbl[0].consumer_idx) :
-		(((OB > IB) ? (ind < OB) : (ind >= IB)) ?
-		 pm8001_ha->inbnd_q_tbl[0].producer_idx :
-		 *((uint32_t *)(pm8001_ha->memoryMap.region[PI].virt_ptr)))));
+			val = (strncmp(file->f_dentry->d_name.name, "ci", 2)
+					== 0) ?
+				pm8001_ha->outbnd_q_tbl[i].consumer_idx :
+				*((uint32_t *)pm8001_ha->outbnd_q_tbl[i].pi_virt);
+		else
+			val = (strncmp(file->f_dentry->d_name.name, "ci", 2)
+					== 0) ?
+				*((uint32_t *)pm8001_ha->inbnd_q_tbl[i].ci_virt) :
+				pm8001_ha->inbnd_q_tbl[i].producer_idx;
+		debug->blob.size += snprintf(
+			debug->buffer + debug->blob.size,
+			debug->allocation.size - debug->blob.size,
+			"[0x%04x] : 0x%x\n", i, val);
 	}
 	file->private_data = debug;
 
@@ -794,6 +1129,21 @@ static void pm8001_debugfs_forensic_dump(
 	int i;
 	const char *prefix = NULL;
 
+	/* Raw dwords never need more room than their text rendering */
+	if (debug->raw) {
+		uint32_t *dp = (uint32_t *)(debug->blob.data +
+						debug->blob.size);
+
+		i = (debug->allocation.size - debug->blob.size) /
+			sizeof(uint32_t);
+		if (i > (size / sizeof(uint32_t)))
+			i = size / sizeof(uint32_t);
+		debug->blob.size += i * sizeof(uint32_t);
+		for (qp = p; i > 0; --i)
+			*(dp++) = *(qp++);
+		return;
+	}
+
 	for (qp = p, i = 0; i < (size / sizeof(uint32_t)); ++i) {
 		if (debug->blob.size > debug->allocation.size) {
 			debug->blob.size = debug->allocation.size;
@@ -874,6 +1224,43 @@ static void pm8001_debugfs_forensic_dump(
 	}
 }
 
+/*
+ *	pm8001_debugfs_forensic_queue_ind - memoryMap region of a queue
+ *	@parent: The iq/NN or oq/NN directory
+ *
+ *	Description:
+ *	All queues of a direction share one region, each queue taking
+ *	PM8001_MPI_QUEUE entries at atoi(NN) * PM8001_MPI_QUEUE.
+ */
+static unsigned
+pm8001_debugfs_forensic_queue_ind(struct dentry *parent)
+{
+	return (strncmp(parent->d_parent->d_name.name, "oq", 2) == 0) ?
+		OB : IB;
+}
+
+/*
+ *	pm8001_debugfs_forensic_queue_fill - Render IOMBs on demand
+ *	@debug: The file data
+ *	@end: The offset the caller needs rendered
+ */
+static int
+pm8001_debugfs_forensic_queue_fill(struct pm8001_debug *debug, loff_t end)
+{
+	struct mpi_mem *region = &debug->pm8001_ha->memoryMap.region[debug->arg];
+	size_t size = region->element_size;
+	unsigned first = debug->item_end - PM8001_MPI_QUEUE;
+
+	for (; (debug->item < debug->item_end) &&
+	       (debug->blob.size < end); ++debug->item)
+		pm8001_debugfs_forensic_dump(debug, QUEUE_FORMAT,
+			((char *)region->virt_ptr) + (debug->item * size),
+			size, debug->item - first);
+	if (debug->item >= debug->item_end)
+		debug->fill = NULL;
+	return 0;
+}
+
 /*
  *	pm8001_debugfs_forensic_queue_open - Open the queue
  *	@inode: The inode pointer
@@ -893,7 +1280,7 @@ pm8001_debugfs_forensic_queue_open(struct inode *inode, struct file *file)
 	unsigned ind, len;
 	int rc = -ENOMEM;
 	size_t size;
-	int cur_iomb, num;
+	int num;
 
 	parent = inode->i_private;
 #if defined(PM8001_DEBUGFS_DEBUG)
@@ -901,12 +1288,10 @@ pm8001_debugfs_forensic_queue_open(struct inode *inode, struct file *file)
 		parent->d_parent->d_parent->d_name.name,
 		parent->d_parent->d_name.name, parent->d_name.name);
 #endif
-	ind = IB + atoi(parent->d_name.name);
-	if (strncmp(parent->d_parent->d_name.name, "oq", 2) == 0)
-		ind += OB - IB;
+	ind = pm8001_debugfs_forensic_queue_ind(parent);
 	pm8001_ha = parent->d_fsdata;
-	/* Cal. no. of IOMBs in the 'ind'th Queue and Size of this Queue */
-	num  = pm8001_ha->memoryMap.region[ind].num_elements;
+	/* Cal. no. of IOMBs in the Queue and Size of an IOMB */
+	num  = PM8001_MPI_QUEUE;
 	size = pm8001_ha->memoryMap.region[ind].element_size;
 
 #if defined(PM8001_DEBUGFS_DEBUG)
@@ -927,12 +1312,15 @@ pm8001_debugfs_forensic_queue_open(struct inode *inode, struct file *file)
 	debug->allocation.size = len;
 	debug->blob.data = debug->buffer;
 	debug->blob.size = 0;
-	for (cur_iomb = 0; cur_iomb < num; ++cur_iomb) {
-		pm8001_debugfs_forensic_dump(debug,	QUEUE_FORMAT,
-			((char *)pm8001_ha->memoryMap.region[ind].virt_ptr) +
-				(cur_iomb * size), size, cur_iomb);
-	}
 	debug->write = NULL;
+	mutex_init(&debug->fill_mutex);
+	debug->fill = pm8001_debugfs_forensic_queue_fill;
+	debug->pm8001_ha = pm8001_ha;
+	atomic_inc(&pm8001_ha->debugfs_users);
+	debug->arg = ind;
+	debug->raw = pm8001_debugfs_is_bin(file);
+	debug->item = atoi(parent->d_name.name) * num;
+	debug->item_end = debug->item + num;
 	file->private_data = debug;
 
 	rc = 0;
@@ -940,13 +1328,34 @@ out:
 	return rc;
 }
 
+/*
+ *	pm8001_debugfs_forensic_queue_mmap - Map the queue entries
+ *	@file: The file pointer
+ *	@vma: The mapping requested by the caller
+ *
+ *	Description:
+ *	This routine is the entry point for the debugfs mmap file operation.
+ *	It exposes the live IOMBs without any formatting; the mapping covers
+ *	every queue of the direction, this one at NN * PM8001_MPI_QUEUE * 64.
+ */
+static int
+pm8001_debugfs_forensic_queue_mmap(struct file *file,
+	struct vm_area_struct *vma)
+{
+	struct dentry *parent = file->f_dentry->d_inode->i_private;
+
+	return pm8001_debugfs_region_mmap(parent->d_fsdata,
+		pm8001_debugfs_forensic_queue_ind(parent), vma);
+}
+
 static const struct file_operations
 pm8001_debugfs_forensic_queue_fop = {
 	.owner =   THIS_MODULE,
 	.open =	   pm8001_debugfs_forensic_queue_open,
 	.llseek =  pm8001_debugfs_lseek,
 	.read =	   pm8001_debugfs_read,
-	.release = pm8001_debugfs_release,
+	.mmap =	   pm8001_debugfs_forensic_queue_mmap,
+	.release = pm8001_debugfs_hba_release,
 };
 
 /*
@@ -974,6 +1383,12 @@ static struct dentry *pm8001_debugfs_forensic_queue_create(
 		root->d_parent->d_name.name, root->d_name.name);
 #endif
 
+	entry = debugfs_create_file("iomb.bin", (S_IFREG|S_IRUGO),
+			root, root,
+			&pm8001_debugfs_forensic_queue_fop);
+	if (IS_ERR_OR_NULL(entry))
+		return entry;
+	entry->d_fsdata = pm8001_ha;
 	entry = debugfs_create_file("iomb", (S_IFREG|S_IRUGO),
 			root, root,
 			&pm8001_debugfs_forensic_queue_fop);
@@ -1141,11 +1556,6 @@ pm8001_debugfs_forensic_op_queue = {
  *	This routine returns the next list entry. Returns NULL when list is
  *	exhausted.
  */
-struct pm8001_debugfs_forensic_mem_list {
-	loff_t offset;
-	size_t size;
-};
-
 static struct pm8001_debugfs_forensic_mem_list *
 pm8001_debugfs_forensic_next_list_entry(
 	struct pm8001_debugfs_forensic_mem_list *entry)
@@ -1155,6 +1565,61 @@ pm8001_debugfs_forensic_next_list_entry(
 	return entry;
 }
 
+/*
+ *	pm8001_debugfs_forensic_memory_fill - Read and render list entries
+ *	@debug: The file data
+ *	@end: The offset the caller needs rendered
+ *
+ *	Description:
+ *	Renders list entries in order until @end is covered, moving the GSM
+ *	window only when an entry needs it.
+ */
+static int
+pm8001_debugfs_forensic_memory_fill(struct pm8001_debug *debug, loff_t end)
+{
+	struct pm8001_hba_info *pm8001_ha = debug->pm8001_ha;
+	struct pm8001_debugfs_forensic_mem_list *next;
+	int bar = debug->arg;
+	unsigned char type = REGISTER_FORMAT;
+	u32 shift = 0xFFFFFFFF;
+	int rc = 0;
+
+	if (bar == 2) {
+		type = GSM_FORMAT;
+		mutex_lock(&pm8001_ha->bar4_mutex);
+	}
+	for (next = debug->next; next && (debug->blob.size < end);
+	     next = (*debug->function)(next)) {
+		u32 offset;
+		if ((next->offset == 0) && (next->size == 0))
+			continue;
+		offset = next->offset;
+		if (bar == 2) {
+			if (((offset & 0xFFFF0000) != shift)
+			 && (-1 == pm8001_bar4_shift(pm8001_ha,
+					offset & 0xFFFF0000))) {
+				rc = -EINVAL;
+				break;
+			}
+			shift = offset & 0xFFFF0000;
+			offset &= 0xFFFF;
+		}
+		pm8001_debugfs_forensic_dump(
+			debug,
+			type,
+			((char *)pm8001_ha->io_mem[bar].memvirtaddr) + offset,
+			next->size, next->offset);
+	}
+	if (bar == 2) {
+		pm8001_bar4_shift(pm8001_ha, 0);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
+	}
+	debug->next = next;
+	if (!next)
+		debug->fill = NULL;
+	return rc;
+}
+
 /*
  *	pm8001_debugfs_forensic_memory_open - Open the registers
  *	@inode: The inode pointer
@@ -1165,8 +1630,8 @@ pm8001_debugfs_forensic_next_list_entry(
  *
  *	Description:
  *	This routine is the entry point for the debugfs open file operation. It
- *	fills the data and returns a pointer to that data in the private_data
- *	field in @file.
+ *	sizes the data and returns a pointer to it in the private_data field in
+ *	@file; the registers are read on demand as the file is read.
  */
 static int
 pm8001_debugfs_forensic_memory_open(
@@ -1178,11 +1643,9 @@ pm8001_debugfs_forensic_memory_open(
 	int bar)
 {
 	struct dentry *parent;
-	struct pm8001_hba_info *pm8001_ha;
 	struct pm8001_debug *debug;
 	int len, rc = -ENOMEM;
 	struct pm8001_debugfs_forensic_mem_list *next;
-	unsigned char type;
 	unsigned int dwords;
 
 	/* Determine printing size of the list to allocate a buffer */
@@ -1210,44 +1673,20 @@ pm8001_debugfs_forensic_memory_open(
 	debug->blob.data = debug->buffer;
 	debug->buffer[0] = '\0';
 	parent = inode->i_private;
-	pm8001_ha = parent->d_fsdata;
-	type = REGISTER_FORMAT;
-	/* Populate */
-	for (next = arg; next; next = (*function)(next)) {
-		u32 offset;
-		unsigned long flags;
-		if ((next->offset == 0) && (next->size == 0))
-			continue;
-		offset = next->offset;
-		if (bar == 2) {
-			type = GSM_FORMAT;
-			while (unlikely(!spin_trylock_irqsave(&pm8001_ha->lock,
-								flags))) {
-				yield();
-				touch_nmi_watchdog();
-			}
-			if (-1 == pm8001_bar4_shift(pm8001_ha,
-					offset & 0xFFFF0000)) {
-				spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-				kfree(debug);
-				rc = -EINVAL;
-				goto out;
-			}
-			offset &= 0xFFFF;
-		}
-		pm8001_debugfs_forensic_dump(
-			debug,
-			type,
-			((char *)pm8001_ha->io_mem[bar].memvirtaddr) + offset,
-			next->size, next->offset);
-		if (bar == 2) {
-			pm8001_bar4_shift(pm8001_ha, 0);
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-			/* Be nice */
-	                yield();
-		}
-	}
 	debug->write = NULL;
+	mutex_init(&debug->fill_mutex);
+	debug->fill = pm8001_debugfs_forensic_memory_fill;
+	debug->pm8001_ha = parent->d_fsdata;
+	atomic_inc(&debug->pm8001_ha->debugfs_users);
+	debug->function = function;
+	debug->arg = bar;
+	debug->raw = pm8001_debugfs_is_bin(file);
+	/* Lists are walked in place, generators advance a private entry */
+	debug->next = arg;
+	if (function != pm8001_debugfs_forensic_next_list_entry) {
+		debug->entry = *arg;
+		debug->next = &debug->entry;
+	}
 	file->private_data = debug;
 
 	rc = 0;
@@ -1287,14 +1726,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_spc = {
 	{
 		.name = "01.SPC",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_spc_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1347,14 +1786,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_bdma = {
 	{
 		.name = "02.BDMA",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_bdma_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1400,14 +1839,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_app = {
 	{
 		.name = "03.APP",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_app_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1492,14 +1931,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_phy = {
 	{
 		.name = "04.PHY",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_phy_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1540,14 +1979,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_core = {
 	{
 		.name = "05.CORE",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_core_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1602,14 +2041,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_ossp = {
 	{
 		.name = "06.OSSP",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_ossp_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1675,14 +2114,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_sspa = {
 	{
 		.name = "07.SSPA",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_sspa_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1717,14 +2156,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_hsst = {
 	{
 		.name = "08.HSST",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_hsst_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1763,14 +2202,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_lms_dss = {
 	{
 		.name = "09.LMS_DSS",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_lms_dss_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1817,14 +2256,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_sspl_6g = {
 	{
 		.name = "10.SPL_6G",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_sspl_6g_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1870,14 +2309,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_hsst1 = {
 	{
 		.name = "11.HSST",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_hsst1_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1916,14 +2355,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_lms_dss1 = {
 	{
 		.name = "12.LMS_DSS",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_lms_dss1_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -1970,14 +2409,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_sspl_6g1 = {
 	{
 		.name = "13.SPL_6G",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_sspl_6g1_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2023,14 +2462,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_hsst2 = {
 	{
 		.name = "14.HSST",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_hsst2_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2080,14 +2519,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_mbic_iop = {
 	{
 		.name = "15.MBIC_IOP",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_mbic_iop_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2137,14 +2576,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_mbic_aap1 = {
 	{
 		.name = "16.MBIC_AAP1",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_mbic_aap1_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2192,14 +2631,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_spbc = {
 	{
 		.name = "17.SPBC",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_spbc_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2289,14 +2728,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gsm_gsm = {
 	{
 		.name = "18.GSM",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_gsm_gsm_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2364,14 +2803,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_msgu = {
 	{
 		.name = "4.msgu",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_msgu_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2414,6 +2853,9 @@ pm8001_debugfs_forensic_eventlog_value_open(
 	debug->blob.data = debug->buffer;
 	debug->blob.size = snprintf(debug->blob.data, len, form, val);
 	debug->write = write;
+	debug->fill = NULL;
+	debug->pm8001_ha = pm8001_ha;
+	atomic_inc(&pm8001_ha->debugfs_users);
 	file->private_data = debug;
 
 	rc = 0;
@@ -2462,7 +2904,8 @@ static int pm8001_writelog(
  *
  *	Description:
  *	This routine is the wrapper for pm8001_mem_alloc that reallocates and
- *	preserves the content of the event logs.
+ *	preserves the content of the event logs. The logs are swapped under
+ *	eventlog_lock, so streams move over to the new ones.
  */
 static inline int
 pm8001_debugfs_forensic_eventlog_realloc(
@@ -2483,6 +2926,12 @@ pm8001_debugfs_forensic_eventlog_realloc(
 
 	if ((pm8001_ha->memoryMap.region[AAP1].total_len == nbytes)
 	 && (pm8001_ha->memoryMap.region[IOP].total_len == nbytes))
+		return 0;
+	/* no new mapping while we look, nor while the logs move */
+	mutex_lock(&pm8001_ha->debugfs_map_mutex);
+	rc = -EBUSY;
+	if (atomic_read(&pm8001_ha->debugfs_mmaps) ||
+	    pm8001_ha->debugfs_revoked)
 		goto out;
 	rc = -EINVAL;
 	if (nbytes >= 4294967295)
@@ -2541,6 +2990,7 @@ pm8001_debugfs_forensic_eventlog_realloc(
 	}
 
 	/* Preserve Events */
+	spin_lock(&pm8001_ha->eventlog_lock);
 
 	/* AAP1 */
 	s_aap1 = pm8001_ha->memoryMap.region[AAP1];
@@ -2560,10 +3010,6 @@ pm8001_debugfs_forensic_eventlog_realloc(
 		!pm8001_writelog(mh_aap1, &entry) &&
 		(i == 0));
 	pm8001_ha->memoryMap.region[AAP1] = m_aap1;
-	pci_free_consistent(pm8001_ha->pdev,
-		s_aap1.real_len,
-		s_aap1.real_addr,
-		s_aap1.phys_addr);
 
 	/* IOP */
 	s_iop = pm8001_ha->memoryMap.region[IOP];
@@ -2583,6 +3029,12 @@ pm8001_debugfs_forensic_eventlog_realloc(
 		!pm8001_writelog(mh_iop, &entry) &&
 		(i == 0));
 	pm8001_ha->memoryMap.region[IOP] = m_iop;
+	spin_unlock(&pm8001_ha->eventlog_lock);
+
+	pci_free_consistent(pm8001_ha->pdev,
+		s_aap1.real_len,
+		s_aap1.real_addr,
+		s_aap1.phys_addr);
 	pci_free_consistent(pm8001_ha->pdev,
 		s_iop.real_len,
 		s_iop.real_addr,
@@ -2590,6 +3042,7 @@ pm8001_debugfs_forensic_eventlog_realloc(
 
 	rc = 0;
 out:
+	mutex_unlock(&pm8001_ha->debugfs_map_mutex);
 	return rc;
 }
 
@@ -2631,6 +3084,11 @@ pm8001_debugfs_forensic_eventlog_write(
 	if (((type == 0) ? 5 : (8 * 1024 * 1024)) < val)
 		return -EINVAL;
 	pm8001_ha = file->f_dentry->d_fsdata;
+	down_read(&pm8001_ha->debugfs_sem);
+	if (pm8001_ha->debugfs_gone) {
+		up_read(&pm8001_ha->debugfs_sem);
+		return -ENODEV;
+	}
 	switch (type) {
 	case 0:
 		form = "Eventlog Level=%d\n";
@@ -2670,6 +3128,7 @@ pm8001_debugfs_forensic_eventlog_write(
 		/* NOTREACHED */
 		form = "\n";
 	}
+	up_read(&pm8001_ha->debugfs_sem);
 	/* Submit update to controller */
 	debug->blob.size = snprintf(debug->blob.data, debug->allocation.size,
 		form, val);
@@ -2733,7 +3192,7 @@ pm8001_debugfs_forensic_op_eventlog_level = {
 		.llseek =  pm8001_debugfs_lseek,
 		.read =    pm8001_debugfs_read,
 		.write =   pm8001_debugfs_write,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2793,7 +3252,7 @@ pm8001_debugfs_forensic_op_eventlog_size = {
 		.llseek =  pm8001_debugfs_lseek,
 		.read =    pm8001_debugfs_read,
 		.write =   pm8001_debugfs_write,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2829,6 +3288,9 @@ pm8001_debugfs_forensic_eventlog_open(
 	debug->blob.size = pm8001_ha->memoryMap.region[ind].element_size;
 	debug->blob.data = pm8001_ha->memoryMap.region[ind].virt_ptr;
 	debug->write = NULL;
+	debug->fill = NULL;
+	debug->pm8001_ha = pm8001_ha;
+	atomic_inc(&pm8001_ha->debugfs_users);
 	file->private_data = debug;
 
 	rc = 0;
@@ -2836,6 +3298,28 @@ out:
 	return rc;
 }
 
+/*
+ *	pm8001_debugfs_forensic_eventlog_mmap - Map an event log
+ *	@file: The file pointer
+ *	@vma: The mapping requested by the caller
+ *	@ind: eventlog index
+ *
+ *	Description:
+ *	This routine is the entry point for the debugfs mmap file operation.
+ *	The log is mapped whole, header included; resizing it through 1.size
+ *	fails with -EBUSY until every mapping is gone.
+ */
+static int
+pm8001_debugfs_forensic_eventlog_mmap(
+	struct file *file,
+	struct vm_area_struct *vma,
+	int ind)
+{
+	struct dentry *parent = file->f_dentry->d_inode->i_private;
+
+	return pm8001_debugfs_region_mmap(parent->d_fsdata, ind, vma);
+}
+
 /*
  *	pm8001_debugfs_forensic_eventlog_aap1_open - Open the aap1 event log
  *	@inode: The inode pointer
@@ -2855,6 +3339,14 @@ pm8001_debugfs_forensic_eventlog_aap1_open(
 	return pm8001_debugfs_forensic_eventlog_open(inode, file, AAP1);
 }
 
+static int
+pm8001_debugfs_forensic_eventlog_aap1_mmap(
+	struct file *file,
+	struct vm_area_struct *vma)
+{
+	return pm8001_debugfs_forensic_eventlog_mmap(file, vma, AAP1);
+}
+
 static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_eventlog_aap1 = {
 	{
@@ -2866,7 +3358,8 @@ pm8001_debugfs_forensic_op_eventlog_aap1 = {
 		.open =	   pm8001_debugfs_forensic_eventlog_aap1_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =    pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.mmap =	   pm8001_debugfs_forensic_eventlog_aap1_mmap,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -2889,6 +3382,14 @@ pm8001_debugfs_forensic_eventlog_iop_open(
 	return pm8001_debugfs_forensic_eventlog_open(inode, file, IOP);
 }
 
+static int
+pm8001_debugfs_forensic_eventlog_iop_mmap(
+	struct file *file,
+	struct vm_area_struct *vma)
+{
+	return pm8001_debugfs_forensic_eventlog_mmap(file, vma, IOP);
+}
+
 static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_eventlog_iop = {
 	{
@@ -2900,10 +3401,364 @@ pm8001_debugfs_forensic_op_eventlog_iop = {
 		.open =	   pm8001_debugfs_forensic_eventlog_iop_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =    pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.mmap =	   pm8001_debugfs_forensic_eventlog_iop_mmap,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
+/*
+ *	Event log streams
+ *
+ *	Each open file keeps its own cursor into the log, so several shippers
+ *	can drain the same log without disturbing each other or the sysfs
+ *	aap_log/iop_log cursor. A read returns as many whole entries as fit,
+ *	either as the sysfs text lines or as raw struct eventlog_entry
+ *	records. Seeking to the start rewinds to the oldest retained entry,
+ *	seeking to the end skips to the newest. An entry the firmware has not
+ *	finished writing holds the stream up until it is complete. The
+ *	firmware raises no interrupt for new entries, so sleepers are woken by
+ *	a worker ticking while anyone waits; teardown stops it from re-arming.
+ *	The logs are only looked at under eventlog_lock, which a resize takes
+ *	to swap them, and not at all once teardown started. A stream holds
+ *	the hba structure, which it may outlive.
+ */
+#define PM8001_EVENTLOG_POLL	(HZ / 10)
+
+struct pm8001_debugfs_eventlog {
+	struct pm8001_hba_info *pm8001_ha;
+	int ind;		/* AAP1 or IOP */
+	int binary;
+	u32 cursor;		/* next entry to return */
+};
+
+/*
+ *	pm8001_debugfs_eventlog_header - Validated event log header
+ *	@log: The stream
+ *
+ *	Description:
+ *	Called with eventlog_lock held.
+ *
+ *	Returns:
+ *	The header, or NULL when the log is not (yet) set up by the firmware
+ *	or is going away.
+ */
+static struct eventlog_header *
+pm8001_debugfs_eventlog_header(struct pm8001_debugfs_eventlog *log)
+{
+	struct eventlog_header *header;
+	unsigned maximum_index;
+
+	if (log->pm8001_ha->eventlog_terminating)
+		return NULL;
+	header = log->pm8001_ha->memoryMap.region[log->ind].virt_ptr;
+	if ((header->offset != sizeof(*header)) ||
+	    (header->entry_size != sizeof(struct eventlog_entry)) ||
+	    ((header->signature != EVENTLOG_HEADER_SIGNATURE_AAP1) &&
+	     (header->signature != EVENTLOG_HEADER_SIGNATURE_IOP)))
+		return NULL;
+	maximum_index = header->size / sizeof(struct eventlog_entry);
+	if ((maximum_index <= header->producer_index) ||
+	    (maximum_index <= header->consumer_index))
+		return NULL;
+	/* Resynchronize a cursor the producer lapped, or a resized log */
+	if ((log->cursor >= maximum_index) ||
+	    ((header->producer_index < header->consumer_index) ?
+	     ((header->producer_index < log->cursor) &&
+	      (log->cursor < header->consumer_index)) :
+	     ((header->producer_index < log->cursor) ||
+	      (log->cursor < header->consumer_index))))
+		log->cursor = header->consumer_index;
+	return header;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_pending - Entries are waiting for the stream
+ *	@log: The stream
+ */
+static int
+pm8001_debugfs_eventlog_pending(struct pm8001_debugfs_eventlog *log)
+{
+	struct pm8001_hba_info *pm8001_ha = log->pm8001_ha;
+	struct eventlog_header *header;
+	int pending;
+
+	spin_lock(&pm8001_ha->eventlog_lock);
+	header = pm8001_debugfs_eventlog_header(log);
+	pending = header && (log->cursor != header->producer_index) &&
+		pm8001_validlog(
+			&((struct eventlog_entry *)(header + 1))[log->cursor]);
+	spin_unlock(&pm8001_ha->eventlog_lock);
+	return pending;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_fetch - Copy the entry at the cursor
+ *	@log: The stream
+ *	@entry: Where to copy it
+ *
+ *	Returns:
+ *	The number of entries the log holds, or zero when there is nothing to
+ *	copy.
+ */
+static unsigned
+pm8001_debugfs_eventlog_fetch(
+	struct pm8001_debugfs_eventlog *log,
+	struct eventlog_entry *entry)
+{
+	struct pm8001_hba_info *pm8001_ha = log->pm8001_ha;
+	struct eventlog_header *header;
+	unsigned maximum_index = 0;
+
+	spin_lock(&pm8001_ha->eventlog_lock);
+	header = pm8001_debugfs_eventlog_header(log);
+	if (header && (log->cursor != header->producer_index)) {
+		maximum_index = header->size / sizeof(*entry);
+		*entry = ((struct eventlog_entry *)(header + 1))[log->cursor];
+	}
+	spin_unlock(&pm8001_ha->eventlog_lock);
+	return maximum_index;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_arm - Schedule the next eventlog_work tick
+ *	@pm8001_ha: The hba
+ *
+ *	Returns:
+ *	zero, or -ENODEV once pm8001_debugfs_terminate() has started.
+ */
+static int
+pm8001_debugfs_eventlog_arm(struct pm8001_hba_info *pm8001_ha)
+{
+	int rc = -ENODEV;
+
+	spin_lock(&pm8001_ha->eventlog_lock);
+	if (!pm8001_ha->eventlog_terminating) {
+		schedule_delayed_work(&pm8001_ha->eventlog_work,
+			PM8001_EVENTLOG_POLL);
+		rc = 0;
+	}
+	spin_unlock(&pm8001_ha->eventlog_lock);
+	return rc;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_work - Let the streams look at the logs
+ *	@work: eventlog_work of the hba
+ *
+ *	Description:
+ *	Wakes the streams so that they re-check both the producer index and
+ *	an entry they are held up on, and keeps ticking for as long as a
+ *	stream is waiting.
+ */
+void pm8001_debugfs_eventlog_work(PMCS_WORK_ARG work)
+{
+	struct pm8001_hba_info *pm8001_ha = container_of(work,
+		struct pm8001_hba_info, eventlog_work.work);
+
+	wake_up_interruptible(&pm8001_ha->eventlog_wait);
+	if (waitqueue_active(&pm8001_ha->eventlog_wait))
+		pm8001_debugfs_eventlog_arm(pm8001_ha);
+}
+
+/*
+ *	pm8001_debugfs_eventlog_open - Open an event log stream
+ *	@inode: The inode pointer
+ *	@file: The file pointer to attach the stream
+ *	@ind: eventlog index
+ *	@binary: Return raw entries rather than text lines
+ */
+static int
+pm8001_debugfs_eventlog_open(
+	struct inode *inode,
+	struct file *file,
+	int ind,
+	int binary)
+{
+	struct dentry *parent = inode->i_private;
+	struct pm8001_debugfs_eventlog *log;
+
+	log = kmalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+	log->pm8001_ha = parent->d_fsdata;
+	atomic_inc(&log->pm8001_ha->debugfs_users);
+	log->ind = ind;
+	log->binary = binary;
+	log->cursor = ~0U; /* oldest entry on first use */
+	file->private_data = log;
+	return 0;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_lseek - Rewind or skip a stream
+ *	@file: The file pointer
+ *	@off: Must be zero
+ *	@whence: SEEK_SET for the oldest entry, SEEK_END for past the newest
+ */
+static loff_t
+pm8001_debugfs_eventlog_lseek(struct file *file, loff_t off, int whence)
+{
+	struct pm8001_debugfs_eventlog *log = file->private_data;
+	struct eventlog_header *header;
+
+	if (off)
+		return -EINVAL;
+	switch (whence) {
+	case 0:
+		log->cursor = ~0U;
+		file->f_pos = 0;
+		break;
+	case 2:
+		spin_lock(&log->pm8001_ha->eventlog_lock);
+		header = pm8001_debugfs_eventlog_header(log);
+		if (header)
+			log->cursor = header->producer_index;
+		spin_unlock(&log->pm8001_ha->eventlog_lock);
+		break;
+	}
+	return file->f_pos;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_read - Read entries from a stream
+ *	@file: The file pointer
+ *	@buf: The buffer to copy the entries to
+ *	@nbytes: The size of @buf
+ *	@ppos: Running count of bytes returned by the stream
+ *
+ *	Description:
+ *	Returns as many whole entries as fit in @buf, stopping at an entry
+ *	the firmware has not finished. Blocks for the first entry unless the
+ *	file is non-blocking.
+ */
+static ssize_t
+pm8001_debugfs_eventlog_read(
+	struct file *file,
+	char __user *buf,
+	size_t nbytes,
+	loff_t *ppos)
+{
+	struct pm8001_debugfs_eventlog *log = file->private_data;
+	struct pm8001_hba_info *pm8001_ha = log->pm8001_ha;
+	struct eventlog_entry entry;
+	char line[128];
+	size_t count = 0;
+	unsigned maximum_index;
+	int len = 0;
+
+retry:
+	while (!pm8001_debugfs_eventlog_pending(log)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (pm8001_debugfs_eventlog_arm(pm8001_ha))
+			return -ENODEV;
+		if (wait_event_interruptible(pm8001_ha->eventlog_wait,
+				pm8001_debugfs_eventlog_pending(log) ||
+				pm8001_ha->eventlog_terminating))
+			return -ERESTARTSYS;
+	}
+	while ((maximum_index = pm8001_debugfs_eventlog_fetch(log, &entry))) {
+		len = 0;
+		if (!pm8001_validlog(&entry))
+			break; /* hold the cursor until it is complete */
+		if (log->binary) {
+			len = sizeof(entry);
+			memcpy(line, &entry, len);
+		} else
+			len = pm8001_formatlog(&entry, line, sizeof(line));
+		if (len > (nbytes - count))
+			break;
+		if (copy_to_user(buf + count, line, len))
+			return count ? count : -EFAULT;
+		count += len;
+		if (++log->cursor >= maximum_index)
+			log->cursor = 0;
+	}
+	if (!count) {
+		if (len > nbytes)
+			return -EINVAL;
+		goto retry; /* the first entry is still being written */
+	}
+	*ppos += count;
+	return count;
+}
+
+/*
+ *	pm8001_debugfs_eventlog_poll - Wait for an entry
+ *	@file: The file pointer
+ *	@wait: The poll table
+ */
+static unsigned int
+pm8001_debugfs_eventlog_poll(struct file *file, poll_table *wait)
+{
+	struct pm8001_debugfs_eventlog *log = file->private_data;
+	struct pm8001_hba_info *pm8001_ha = log->pm8001_ha;
+
+	poll_wait(file, &pm8001_ha->eventlog_wait, wait);
+	if (pm8001_debugfs_eventlog_pending(log))
+		return POLLIN | POLLRDNORM;
+	if (pm8001_debugfs_eventlog_arm(pm8001_ha))
+		return POLLERR;
+	return 0;
+}
+
+static int
+pm8001_debugfs_eventlog_release(struct inode *inode, struct file *file)
+{
+	struct pm8001_debugfs_eventlog *log = file->private_data;
+
+	pm8001_debugfs_put(log->pm8001_ha);
+	kfree(log);
+	file->private_data = NULL;
+	return 0;
+}
+
+static int
+pm8001_debugfs_eventlog_aap1_log_open(struct inode *inode, struct file *file)
+{
+	return pm8001_debugfs_eventlog_open(inode, file, AAP1, 0);
+}
+
+static int
+pm8001_debugfs_eventlog_iop_log_open(struct inode *inode, struct file *file)
+{
+	return pm8001_debugfs_eventlog_open(inode, file, IOP, 0);
+}
+
+static int
+pm8001_debugfs_eventlog_aap1_bin_open(struct inode *inode, struct file *file)
+{
+	return pm8001_debugfs_eventlog_open(inode, file, AAP1, 1);
+}
+
+static int
+pm8001_debugfs_eventlog_iop_bin_open(struct inode *inode, struct file *file)
+{
+	return pm8001_debugfs_eventlog_open(inode, file, IOP, 1);
+}
+
+#define PM8001_EVENTLOG_STREAM(_name, _open)				\
+static const struct pm8001_file_operations				\
+pm8001_debugfs_forensic_op_eventlog_##_open = {				\
+	{								\
+		.name = _name,						\
+		.type = PM8001_OP_FILE_RO				\
+	},								\
+	{								\
+		.owner =   THIS_MODULE,					\
+		.open =	   pm8001_debugfs_eventlog_##_open##_open,	\
+		.llseek =  pm8001_debugfs_eventlog_lseek,		\
+		.read =	   pm8001_debugfs_eventlog_read,		\
+		.poll =	   pm8001_debugfs_eventlog_poll,		\
+		.release = pm8001_debugfs_eventlog_release,		\
+	}								\
+}
+
+PM8001_EVENTLOG_STREAM("5.aap1_log", aap1_log);
+PM8001_EVENTLOG_STREAM("6.iop_log", iop_log);
+PM8001_EVENTLOG_STREAM("7.aap1_bin", aap1_bin);
+PM8001_EVENTLOG_STREAM("8.iop_bin", iop_bin);
+
 static const struct pm8001_dir_operations
 pm8001_debugfs_forensic_op_eventlog = {
 	{
@@ -2915,6 +3770,10 @@ pm8001_debugfs_forensic_op_eventlog = {
 		&pm8001_debugfs_forensic_op_eventlog_size.header,
 		&pm8001_debugfs_forensic_op_eventlog_aap1.header,
 		&pm8001_debugfs_forensic_op_eventlog_iop.header,
+		&pm8001_debugfs_forensic_op_eventlog_aap1_log.header,
+		&pm8001_debugfs_forensic_op_eventlog_iop_log.header,
+		&pm8001_debugfs_forensic_op_eventlog_aap1_bin.header,
+		&pm8001_debugfs_forensic_op_eventlog_iop_bin.header,
 		NULL
 	}
 };
@@ -2951,10 +3810,12 @@ pm8001_debugfs_forensic_gstmpi_open(
 	debug->blob.data = debug->buffer;
 
 	debug->blob.size = 0;
+	debug->raw = pm8001_debugfs_is_bin(file);
 	pm8001_debugfs_forensic_dump(debug, REGISTER_FORMAT,
 				p , size, 0);
 
 	debug->write = NULL;
+	debug->fill = NULL;
 	file->private_data = debug;
 
 	rc = 0;
@@ -2994,7 +3855,7 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_mpi_configuration = {
 	{
 		.name = "6.mpi_config",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
@@ -3039,7 +3900,7 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_gst = {
 	{
 		.name = "7.gst",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
@@ -3084,7 +3945,7 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_mpi_inbound_queue = {
 	{
 		.name = "8.mpi_iqueue",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
@@ -3129,7 +3990,7 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_mpi_outbound_queue = {
 	{
 		.name = "8.mpi_oqueue",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
@@ -3213,14 +4074,14 @@ static const struct pm8001_file_operations
 pm8001_debugfs_forensic_op_analog = {
 	{
 		.name = "9.analog",
-		.type = PM8001_OP_FILE_RO
+		.type = PM8001_OP_FILE_BIN
 	},
 	{
 		.owner =   THIS_MODULE,
 		.open =	   pm8001_debugfs_forensic_analog_open,
 		.llseek =  pm8001_debugfs_lseek,
 		.read =	   pm8001_debugfs_read,
-		.release = pm8001_debugfs_release,
+		.release = pm8001_debugfs_hba_release,
 	}
 };
 
@@ -3266,6 +4127,12 @@ void pm8001_debugfs_initialize(struct pm8001_hba_info *pm8001_ha)
 #ifdef CONFIG_SCSI_PM8001_DEBUG_FS
 	char name[64];
 
+	spin_lock(&pm8001_ha->eventlog_lock);
+	pm8001_ha->eventlog_terminating = 0;
+	spin_unlock(&pm8001_ha->eventlog_lock);
+	down_write(&pm8001_ha->debugfs_sem);
+	pm8001_ha->debugfs_gone = 0;
+	up_write(&pm8001_ha->debugfs_sem);
 	if (!pm8001_debugfs_enable)
 		return;
 
@@ -3401,6 +4268,19 @@ static void debugfs_remove_recursive(struct dentry *dentry)
 void pm8001_debugfs_terminate(struct pm8001_hba_info *pm8001_ha)
 {
 #ifdef CONFIG_SCSI_PM8001_DEBUG_FS
+	/*
+	 * Streams check the flag under the lock before re-arming the work,
+	 * and before looking at a log
+	 */
+	spin_lock(&pm8001_ha->eventlog_lock);
+	pm8001_ha->eventlog_terminating = 1;
+	spin_unlock(&pm8001_ha->eventlog_lock);
+	/* Open nodes stop reading the hardware, once those doing it are out */
+	down_write(&pm8001_ha->debugfs_sem);
+	pm8001_ha->debugfs_gone = 1;
+	up_write(&pm8001_ha->debugfs_sem);
+	wake_up_interruptible(&pm8001_ha->eventlog_wait);
+	cancel_delayed_work_sync(&pm8001_ha->eventlog_work);
 	if (pm8001_ha->hba_debugfs_root) {
 		debugfs_remove_recursive(pm8001_ha->hba_debugfs_root);
 		pm8001_ha->hba_debugfs_root = NULL;
@@ -3413,3 +4293,54 @@ void pm8001_debugfs_terminate(struct pm8001_hba_info *pm8001_ha)
 #endif
 	return;
 }
+
+/*
+ *	pm8001_debugfs_revoke - Empty the user mappings of the regions
+ *	@pm8001_ha: Hba information structure
+ *
+ *	Description:
+ *	Region mappings made through the forensic nodes point at the host
+ *	memory shared with the chip, and outlive the nodes themselves. The
+ *	remove path calls this after pm8001_debugfs_terminate() and before
+ *	the regions are freed. The pages are taken out of every mapping, and
+ *	no new mapping is made; the mappings themselves stay until munmap(),
+ *	holding only the hba structure.
+ */
+void pm8001_debugfs_revoke(struct pm8001_hba_info *pm8001_ha)
+{
+#ifdef CONFIG_SCSI_PM8001_DEBUG_FS
+	struct pm8001_debugfs_mapped *mapped, *next;
+
+	mutex_lock(&pm8001_ha->debugfs_map_mutex);
+	pm8001_ha->debugfs_revoked = 1;
+	if (atomic_read(&pm8001_ha->debugfs_mmaps))
+		pm8001_printk("pm8001.%d: revoking %d forensic mappings\n",
+			pm8001_ha->id, atomic_read(&pm8001_ha->debugfs_mmaps));
+	list_for_each_entry_safe(mapped, next, &pm8001_ha->debugfs_mapped,
+			list) {
+		unmap_mapping_range(mapped->inode->i_mapping, 0, 0, 1);
+		iput(mapped->inode);
+		list_del(&mapped->list);
+		kfree(mapped);
+	}
+	mutex_unlock(&pm8001_ha->debugfs_map_mutex);
+#endif
+}
+
+/*
+ *	pm8001_debugfs_put - Drop a hold on the hba structure
+ *	@pm8001_ha: Hba information structure
+ *
+ *	Description:
+ *	The hba holds itself until pm8001_free(), and every region mapping,
+ *	event log stream and node that goes back to it after open holds it
+ *	too; the last one frees it.
+ */
+void pm8001_debugfs_put(struct pm8001_hba_info *pm8001_ha)
+{
+#ifdef CONFIG_SCSI_PM8001_DEBUG_FS
+	if (!atomic_dec_and_test(&pm8001_ha->debugfs_users))
+		return;
+#endif
+	PMFREE(pm8001_ha, sizeof(struct pm8001_hba_info));
+}
@@ -72,6 +72,12 @@
 #define EXTRA_IRQ_ARGS  
 #endif
 
+#ifdef __GFP_DIRECT_RECLAIM
+#define	PMCS_GFP_CAN_SLEEP(f)	((f) & __GFP_DIRECT_RECLAIM)
+#else
+#define	PMCS_GFP_CAN_SLEEP(f)	((f) & __GFP_WAIT)
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 20)
 #define PMCS_WORK_ARG                void *
 static inline void INIT_WORK_compat(struct work_struct *work, void *func)
@@ -88,6 +94,25 @@ static inline void INIT_WORK_compat(struct work_struct *work, void *func)
 #define sg_page(_sg) ((_sg)->page)
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 25)
+#define is_vmalloc_addr(x)	\
+	((unsigned long)(x) >= VMALLOC_START && (unsigned long)(x) < VMALLOC_END)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+#define usleep_range(min, max)	msleep(DIV_ROUND_UP((min), 1000))
+#endif
+
+#ifndef __cold
+#define	__cold
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 27)
+/* no protection information before the midlayer knew about it */
+#define	SCSI_PROT_NORMAL	0
+#define	scsi_get_prot_op(cmd)	SCSI_PROT_NORMAL
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,24)
 #include <linux/kernel.h>
 #include <scsi/sas.h>
@@ -156,12 +181,40 @@ enum port_type {
 /* maximum mpi queue entries */
 #define PM8001_MPI_QUEUE         ((PM8001_MAX_CCB) * 2)
 
-#define	PM8001_MAX_INB_NUM	 1
-#define	PM8001_MAX_OUTB_NUM	 1
+#define	PM8001_MAX_INB_NUM	 2
+#define	PM8001_MAX_OUTB_NUM	 2
+/*
+ * single tag aborts, TMFs and device management bypass the I/O ring;
+ * ABORT_ALL and deregistration stay behind the I/O of their device
+ */
+#define	PM8001_IQ_NORMAL	 0
+#define	PM8001_IQ_HIGH		 1
+#define	PM8001_OQ_NORMAL	 0
+#define	PM8001_OQ_HIGH		 1
 #define PM8001_RESERVED_CCB      176
+/* of the reserved CCBs, the top ones are kept for error handling */
+#define	PM8001_INTERNAL_CCB	 32
+#define	PM8001_INTERNAL_TASKS	 8	/* preallocated TMF/abort tasks */
 /* SCSI Queue depth */
 #define	PM8001_CAN_QUEUE	 (PM8001_MAX_CCB - PM8001_RESERVED_CCB)
-#define PM8001_MAX_HW_SECTORS	 32768  /* Max 512 byte sectors per transfer */
+/*
+ * Max 512 byte sectors per transfer. The IOMB data length is 32 bits and
+ * chained PRDs have no length limit of their own; this is the most the
+ * midlayer's 16 bit max_sectors holds, and the ATA LBA48 maximum.
+ */
+#define PM8001_MAX_HW_SECTORS	 0xFFFF
+#define	PM8001_PRD_CHAIN_SG	 256	/* PRDs in one chained 4KB table */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 25)
+/* the midlayer chains scatterlists, so past SG_ALL the PRD tables chain */
+#define	PM8001_MAX_CHAIN_SG	 2048
+#else
+#define	PM8001_MAX_CHAIN_SG	 PM8001_MAX_DMA_SG
+#endif
+/* chained tables one CCB can need behind its own PRD table */
+#define	PM8001_MAX_PRD_CHAIN	 \
+	DIV_ROUND_UP(PM8001_MAX_CHAIN_SG - PM8001_MAX_DMA_SG + 1, \
+		PM8001_PRD_CHAIN_SG - 1)
+#define	PM8001_MAX_CDB_LEN	 32	/* past 16 bytes needs SSPINIEXTIOSTART */
 
 /* unchangeable hardware details */
 #define	PM8001_MAX_PHYS		 8	/* max. possible phys */
@@ -41,6 +41,8 @@
  */
 #include <linux/slab.h>
 #include <linux/stringify.h>
+#include <linux/ktime.h>
+#include <scsi/scsi_eh.h>
 #include "pm8001_sas.h"
 #include "pm8001_hwi.h"
 #include "pm8001_chips.h"
@@ -137,7 +139,7 @@ read_general_status_table(struct pm8001_hba_info *pm8001_ha)
 static void
 read_inbnd_queue_table(struct pm8001_hba_info *pm8001_ha)
 {
-	int inbQ_num = 1;
+	int inbQ_num = PM8001_MAX_INB_NUM;
 	int i;
 	void __iomem *address = pm8001_ha->inbnd_q_tbl_addr;
 	for (i = 0; i < inbQ_num; i++) {
@@ -156,7 +158,7 @@ read_inbnd_queue_table(struct pm8001_hba_info *pm8001_ha)
 static void
 read_outbnd_queue_table(struct pm8001_hba_info *pm8001_ha)
 {
-	int outbQ_num = 1;
+	int outbQ_num = PM8001_MAX_OUTB_NUM;
 	int i;
 	void __iomem *address = pm8001_ha->outbnd_q_tbl_addr;
 	for (i = 0; i < outbQ_num; i++) {
@@ -168,6 +170,13 @@ read_outbnd_queue_table(struct pm8001_hba_info *pm8001_ha)
 	}
 }
 
+/* bus address @off bytes into an aligned memoryMap region */
+static inline u64 pm8001_region_bus(struct mpi_mem *region, u32 off)
+{
+	return ((((u64)region->phys_addr_hi) << 32) | region->phys_addr_lo) +
+		off;
+}
+
 /**
  * init_default_table_values - init the default table.
  * @pm8001_ha: our hba card information
@@ -175,9 +184,9 @@ read_outbnd_queue_table(struct pm8001_hba_info *pm8001_ha)
 static void
 init_default_table_values(struct pm8001_hba_info *pm8001_ha)
 {
-	int qn = 1;
 	int i;
 	u32 offsetib, offsetob;
+	u64 base;
 	void __iomem *addressib = pm8001_ha->inbnd_q_tbl_addr;
 	void __iomem *addressob = pm8001_ha->outbnd_q_tbl_addr;
 
@@ -210,23 +219,39 @@ init_default_table_values(struct pm8001_hba_info *pm8001_ha)
 	pm8001_ha->main_cfg_tbl.iop_event_log_option		=
 		pm8001_ha->logging_option;
 	pm8001_ha->main_cfg_tbl.fatal_err_interrupt		= 0x01;
-	for (i = 0; i < qn; i++) {
+	/*
+	 * Each queue is a PM8001_MPI_QUEUE slice of the IB/OB regions, with
+	 * its index in the matching slot of CI/PI. The high priority inbound
+	 * queue has its replies steered to its own outbound queue.
+	 */
+	for (i = 0; i < PM8001_MAX_INB_NUM; i++) {
+		pm8001_ha->inbnd_q_tbl[i].hpriority =
+			(i == PM8001_IQ_HIGH) ? 1 : 0;
+		pm8001_ha->inbnd_q_tbl[i].response_queue =
+			(i == PM8001_IQ_HIGH) ?
+				PM8001_OQ_HIGH : PM8001_OQ_NORMAL;
 		pm8001_ha->inbnd_q_tbl[i].element_pri_size_cnt	=
-			PM8001_MPI_QUEUE | (64 << 16) | (0x00<<30);
+			PM8001_MPI_QUEUE | (64 << 16) |
+			(pm8001_ha->inbnd_q_tbl[i].hpriority << 30);
+		base = pm8001_region_bus(&pm8001_ha->memoryMap.region[IB],
+			(i * PM8001_MPI_QUEUE * 64));
 		pm8001_ha->inbnd_q_tbl[i].upper_base_addr	=
-			pm8001_ha->memoryMap.region[IB].phys_addr_hi;
+			upper_32_bits(base);
 		pm8001_ha->inbnd_q_tbl[i].lower_base_addr	=
-		pm8001_ha->memoryMap.region[IB].phys_addr_lo;
+			lower_32_bits(base);
 		pm8001_ha->inbnd_q_tbl[i].base_virt		=
-			(u8 *)pm8001_ha->memoryMap.region[IB].virt_ptr;
+			(u8 *)pm8001_ha->memoryMap.region[IB].virt_ptr +
+			(i * PM8001_MPI_QUEUE * 64);
 		pm8001_ha->inbnd_q_tbl[i].total_length		=
-			pm8001_ha->memoryMap.region[IB].total_len;
+			PM8001_MPI_QUEUE * 64;
+		base = pm8001_region_bus(&pm8001_ha->memoryMap.region[CI],
+			(i * 4));
 		pm8001_ha->inbnd_q_tbl[i].ci_upper_base_addr	=
-			pm8001_ha->memoryMap.region[CI].phys_addr_hi;
+			upper_32_bits(base);
 		pm8001_ha->inbnd_q_tbl[i].ci_lower_base_addr	=
-			pm8001_ha->memoryMap.region[CI].phys_addr_lo;
+			lower_32_bits(base);
 		pm8001_ha->inbnd_q_tbl[i].ci_virt		=
-			pm8001_ha->memoryMap.region[CI].virt_ptr;
+			(u8 *)pm8001_ha->memoryMap.region[CI].virt_ptr + i * 4;
 		offsetib = i * 0x20;
 		pm8001_ha->inbnd_q_tbl[i].pi_pci_bar		=
 			get_pci_bar_index(pm8001_mr32(addressib,
@@ -236,25 +261,31 @@ init_default_table_values(struct pm8001_hba_info *pm8001_ha)
 		pm8001_ha->inbnd_q_tbl[i].producer_idx		= 0;
 		pm8001_ha->inbnd_q_tbl[i].consumer_index	= 0;
 	}
-	for (i = 0; i < qn; i++) {
+	for (i = 0; i < PM8001_MAX_OUTB_NUM; i++) {
 		pm8001_ha->outbnd_q_tbl[i].element_size_cnt	=
 			PM8001_MPI_QUEUE | (64 << 16) | (0x01<<30);
+		base = pm8001_region_bus(&pm8001_ha->memoryMap.region[OB],
+			(i * PM8001_MPI_QUEUE * 64));
 		pm8001_ha->outbnd_q_tbl[i].upper_base_addr	=
-			pm8001_ha->memoryMap.region[OB].phys_addr_hi;
+			upper_32_bits(base);
 		pm8001_ha->outbnd_q_tbl[i].lower_base_addr	=
-			pm8001_ha->memoryMap.region[OB].phys_addr_lo;
+			lower_32_bits(base);
 		pm8001_ha->outbnd_q_tbl[i].base_virt		=
-			(u8 *)pm8001_ha->memoryMap.region[OB].virt_ptr;
+			(u8 *)pm8001_ha->memoryMap.region[OB].virt_ptr +
+			(i * PM8001_MPI_QUEUE * 64);
 		pm8001_ha->outbnd_q_tbl[i].total_length		=
-			pm8001_ha->memoryMap.region[OB].total_len;
+			PM8001_MPI_QUEUE * 64;
+		base = pm8001_region_bus(&pm8001_ha->memoryMap.region[PI],
+			(i * 4));
 		pm8001_ha->outbnd_q_tbl[i].pi_upper_base_addr	=
-			pm8001_ha->memoryMap.region[PI].phys_addr_hi;
+			upper_32_bits(base);
 		pm8001_ha->outbnd_q_tbl[i].pi_lower_base_addr	=
-			pm8001_ha->memoryMap.region[PI].phys_addr_lo;
+			lower_32_bits(base);
+		/* all queues share interrupt vector 0 */
 		pm8001_ha->outbnd_q_tbl[i].interrup_vec_cnt_delay	=
 			0 | (10 << 16) | (0 << 24);
 		pm8001_ha->outbnd_q_tbl[i].pi_virt		=
-			pm8001_ha->memoryMap.region[PI].virt_ptr;
+			(u8 *)pm8001_ha->memoryMap.region[PI].virt_ptr + i * 4;
 		offsetob = i * 0x24;
 		pm8001_ha->outbnd_q_tbl[i].ci_pci_bar		=
 			get_pci_bar_index(pm8001_mr32(addressob,
@@ -1685,10 +1716,12 @@ mpi_set_phys_g3_with_ssc(struct pm8001_hba_info *pm8001_ha, u32 SSCbit)
     * Using shifted destination address 0x3_0000:0x1074 + 0x4000*N (N=0:3)
     * Using shifted destination address 0x4_0000:0x1074 + 0x4000*(N-4) (N=4:7)
     */
+	mutex_lock(&pm8001_ha->bar4_mutex);
 	spin_lock_irqsave(&pm8001_ha->lock, flags);
 	if (-1 == pm8001_bar4_shift(pm8001_ha,
 				SAS2_SETTINGS_LOCAL_PHY_0_3_SHIFT_ADDR)) {
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		return;
 	}
 
@@ -1700,6 +1733,7 @@ mpi_set_phys_g3_with_ssc(struct pm8001_hba_info *pm8001_ha, u32 SSCbit)
 	if (-1 == pm8001_bar4_shift(pm8001_ha,
 				SAS2_SETTINGS_LOCAL_PHY_4_7_SHIFT_ADDR)) {
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		return;
 	}
 	for (i = 4; i < 8; i++) {
@@ -1727,6 +1761,7 @@ mpi_set_phys_g3_with_ssc(struct pm8001_hba_info *pm8001_ha, u32 SSCbit)
 	/*set the shifted destination address to 0x0 to avoid error operation */
 	pm8001_bar4_shift(pm8001_ha, 0x0);
 	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	mutex_unlock(&pm8001_ha->bar4_mutex);
 	return;
 }
 
@@ -1751,11 +1786,13 @@ mpi_set_open_retry_interval_reg(struct pm8001_hba_info *pm8001_ha,
 #define OPEN_RETRY_INTERVAL_REG_MASK 0x0000FFFF
 
 	value = interval & OPEN_RETRY_INTERVAL_REG_MASK;
+	mutex_lock(&pm8001_ha->bar4_mutex);
 	spin_lock_irqsave(&pm8001_ha->lock, flags);
 	/* shift bar and set the OPEN_REJECT(RETRY) interval time of PHY 0 -3.*/
 	if (-1 == pm8001_bar4_shift(pm8001_ha,
 			     OPEN_RETRY_INTERVAL_PHY_0_3_SHIFT_ADDR)) {
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		return;
 	}
 	for (i = 0; i < 4; i++) {
@@ -1766,6 +1803,7 @@ mpi_set_open_retry_interval_reg(struct pm8001_hba_info *pm8001_ha,
 	if (-1 == pm8001_bar4_shift(pm8001_ha,
 			     OPEN_RETRY_INTERVAL_PHY_4_7_SHIFT_ADDR)) {
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		return;
 	}
 	for (i = 4; i < 8; i++) {
@@ -1775,30 +1813,105 @@ mpi_set_open_retry_interval_reg(struct pm8001_hba_info *pm8001_ha,
 	/*set the shifted destination address to 0x0 to avoid error operation */
 	pm8001_bar4_shift(pm8001_ha, 0x0);
 	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	mutex_unlock(&pm8001_ha->bar4_mutex);
 	return;
 }
 
+const char * const pm8001_init_phase_name[PM8001_PHASE_MAX] = {
+	[PM8001_PHASE_FW_READY]		= "fw_ready",
+	[PM8001_PHASE_MPI_INIT]		= "mpi_init",
+	[PM8001_PHASE_MPI_UNINIT]	= "mpi_uninit",
+	[PM8001_PHASE_MPI_STOP]		= "mpi_stop",
+	[PM8001_PHASE_RST_NMI]		= "rst_nmi",
+	[PM8001_PHASE_RST_SETTLE]	= "rst_settle",
+	[PM8001_PHASE_RST_TOGGLE]	= "rst_toggle",
+	[PM8001_PHASE_HDA_IDLE]		= "hda_idle",
+	[PM8001_PHASE_HDA_EXEC]		= "hda_exec",
+	[PM8001_PHASE_HDA_AAP1]		= "hda_aap1",
+	[PM8001_PHASE_HDA_IOP]		= "hda_iop",
+	[PM8001_PHASE_HDA_READY]	= "hda_ready",
+};
+
+/*
+ * Wait between two reads of a polled register. Bring-up, reset and
+ * teardown all run in process context with no locks held, so this sleeps.
+ */
+static void pm8001_poll_delay(u32 us)
+{
+	might_sleep();
+	if (us >= 20000)
+		msleep(us / 1000);
+	else
+		usleep_range(us, us + (us >> 2) + 1);
+}
+
+static void pm8001_poll_done(struct pm8001_hba_info *pm8001_ha,
+	enum pm8001_init_phase phase, ktime_t start, int rc)
+{
+	s64 us = ktime_us_delta(ktime_get(), start);
+
+	pm8001_ha->init_phase_us[phase] = (u32)us;
+	PM8001_INIT_DBG(pm8001_ha,
+		pm8001_printk("%s %s after %lld us\n",
+		pm8001_init_phase_name[phase],
+		rc ? "timed out" : "done", (long long)us));
+}
+
+/**
+ * pm8001_poll - wait for a chip condition during bring-up
+ * @pm8001_ha: our hba card information
+ * @phase: init phase the wait is charged to
+ * @cond: expression, evaluated until it is true
+ * @step_us: delay between evaluations
+ * @timeout_us: give up after this long
+ *
+ * Evaluates to 0 once @cond holds or -ETIMEDOUT. The time taken is
+ * kept in init_phase_us[@phase].
+ */
+#define pm8001_poll(pm8001_ha, phase, cond, step_us, timeout_us)	\
+({									\
+	ktime_t __start = ktime_get();					\
+	ktime_t __end = ktime_add_us(__start, (timeout_us));		\
+	int __rc;							\
+	for (;;) {							\
+		if (cond) {						\
+			__rc = 0;					\
+			break;						\
+		}							\
+		if (ktime_to_ns(ktime_sub(ktime_get(), __end)) > 0) {	\
+			__rc = (cond) ? 0 : -ETIMEDOUT;			\
+			break;						\
+		}							\
+		pm8001_poll_delay(step_us);				\
+	}								\
+	pm8001_poll_done(pm8001_ha, phase, __start, __rc);		\
+	__rc;								\
+})
+
+/* settle for a fixed time, charged to @phase like a poll */
+static void pm8001_settle(struct pm8001_hba_info *pm8001_ha,
+	enum pm8001_init_phase phase, u32 us)
+{
+	ktime_t start = ktime_get();
+
+	pm8001_poll_delay(us);
+	pm8001_poll_done(pm8001_ha, phase, start, 0);
+}
+
 /**
  * mpi_init_check - check firmware initialization status.
  * @pm8001_ha: our hba card information
  */
 static int mpi_init_check(struct pm8001_hba_info *pm8001_ha)
 {
-	u32 max_wait_count;
-	u32 value;
 	u32 gst_len_mpistate;
 	/* Write bit0=1 to Inbound DoorBell Register to tell the SPC FW the
 	table is updated */
 	pm8001_cw32(pm8001_ha, 0, MSGU_IBDB_SET, SPC_MSGU_CFG_TABLE_UPDATE);
-	/* wait until Inbound DoorBell Clear Register toggled */
-	max_wait_count = 1 * 1000 * 1000;/* 1 sec */
-	do {
-		udelay(1);
-		value = pm8001_cr32(pm8001_ha, 0, MSGU_IBDB_SET);
-		value &= SPC_MSGU_CFG_TABLE_UPDATE;
-	} while ((value != 0) && (--max_wait_count));
-
-	if (!max_wait_count) {
+	/* wait until Inbound DoorBell Clear Register toggled - 1 sec */
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_MPI_INIT,
+			!(pm8001_cr32(pm8001_ha, 0, MSGU_IBDB_SET)
+			 & SPC_MSGU_CFG_TABLE_UPDATE), 20, 1000000)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("Timeout on Inbound Doorbell\n"));
 		return -1;
@@ -1831,7 +1944,6 @@ static int mpi_init_check(struct pm8001_hba_info *pm8001_ha)
 static int check_fw_ready(struct pm8001_hba_info *pm8001_ha)
 {
 	u32 value, value1;
-	u32 max_wait_count;
 	/* check error state */
 	value = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1);
 	value1 = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2);
@@ -1864,18 +1976,14 @@ static int check_fw_ready(struct pm8001_hba_info *pm8001_ha)
 		return -1;
 	}
 
-	max_wait_count = 1 * 1000 * 1000;/* 1 sec timeout */
-
-	/* wait until scratch pad 1 and 2 registers in ready state  */
-	do {
-		udelay(1);
-		value = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1)
-			& SCRATCH_PAD1_RDY;
-		value1 = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2)
-			& SCRATCH_PAD2_RDY;
-		if ((--max_wait_count) == 0)
-			return -1;
-	} while ((value != SCRATCH_PAD1_RDY) || (value1 != SCRATCH_PAD2_RDY));
+	/* wait until scratch pad 1 and 2 registers in ready state - 1 sec */
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_FW_READY,
+			((pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1)
+			  & SCRATCH_PAD1_RDY) == SCRATCH_PAD1_RDY)
+			&& ((pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2)
+			  & SCRATCH_PAD2_RDY) == SCRATCH_PAD2_RDY),
+			100, 1000000))
+		return -1;
 	return 0;
 }
 
@@ -1964,151 +2072,89 @@ static void pm8001_hda_send_cmd(struct pm8001_hba_info *pm8001_ha,
 
 static u32 pm8001_hda_recv_rsp(struct pm8001_hba_info *pm8001_ha, u32 cmd)
 {
-	u32	rsp;
-	u32	i = 0;
-
-	do {
-		mdelay(10);
-		rsp = pm8001_cr32(pm8001_ha, 3, HDA_CMD_OFFSET+28);
-		rsp = rsp & HDA_CODE_BITS;
-
-		switch (cmd) {
-		case HDAC_CMD_EXEC:
-			if (rsp == HDA_RSP_EXEC)
-				return 1;
-			if (rsp == HDA_RSP_BAD_IMG)
-				return 0;
-			if (rsp == HDA_RSP_BAD_CMD)
-				return 0;
-			break;
-		}
-		i++;
-	} while (i < 200);
+	u32	rsp = 0;
+
+	switch (cmd) {
+	case HDAC_CMD_EXEC:
+		pm8001_poll(pm8001_ha, PM8001_PHASE_HDA_EXEC,
+			((rsp = pm8001_cr32(pm8001_ha, 3, HDA_CMD_OFFSET+28)
+			  & HDA_CODE_BITS) == HDA_RSP_EXEC)
+			|| (rsp == HDA_RSP_BAD_IMG)
+			|| (rsp == HDA_RSP_BAD_CMD), 1000, 2000000);
+		if ((rsp == HDA_RSP_BAD_IMG) || (rsp == HDA_RSP_BAD_CMD))
+			return 0;
+		break;
+	}
 
 	return 1;
 }
 
+/**
+ * pm8001_bar4_cpy - copy an image into GSM through the BAR 2 window.
+ * @pm8001_ha: our hba card information
+ * @base: GSM base address of the destination
+ * @offset: offset from @base
+ * @array: the image
+ * @alen: length of the image in bytes
+ *
+ * Each 64KB window is written with one memcpy_toio straight from the
+ * image and flushed with a read back before the window moves on. Only
+ * bar4_mutex is held, interrupts stay on for the whole copy.
+ */
 static u32 pm8001_bar4_cpy(struct pm8001_hba_info *pm8001_ha,
 	u32 base, u32 offset, const unsigned char array[], u32 alen)
 {
 	u32	dbase;
 	u32	doffset;
-	u32	*larray;
-	u32	val;
 	u32	csize;
-	u32	wc;
-	u32	i = 0;
-	unsigned long flags;
+	u32	total = alen;
+	u32	ret = 1;
+	ktime_t	start;
+	s64	us;
 
 	PM8001_INIT_DBG(pm8001_ha, pm8001_printk("alen = 0x%x\n", alen));
 
 	dbase = (base+offset) & MB3_SHIFT_MASK;
 	doffset = offset & MB3_OFFSET_MASK;
-	spin_lock_irqsave(&pm8001_ha->lock, flags);
-	do {
+	start = ktime_get();
+	mutex_lock(&pm8001_ha->bar4_mutex);
+	while (alen != 0) {
+		void __iomem *dst;
+
 		if (-1 == pm8001_bar4_shift(pm8001_ha, dbase)) {
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-			return 0;
+			ret = 0;
+			break;
 		}
-
-		if ((doffset+alen) > SIZE_64KB)
-			csize = SIZE_64KB - doffset;
-		else
-			csize = alen;
-
-		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR dbase = 0x%x\n", dbase));
-		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR doffset = 0x%x\n", doffset));
-		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR size = 0x%x\n", csize));
-
-		wc = ((csize % 4) > 0) ? ((csize / 4) + 1) : (csize / 4);
-		larray = (u32 *)array;
-		for (i = 0; i < wc; i++) {
-			val = larray[i];
-			pm8001_cw32(pm8001_ha, 2, (doffset + (i*4)), val);
+		csize = min_t(u32, alen, SIZE_64KB - doffset);
+		dst = pm8001_ha->io_mem[2].memvirtaddr + doffset;
+		memcpy_toio(dst, array, csize & ~3);
+		if (csize & 3) {
+			/* pad the last dword */
+			u32 val = 0;
+			memcpy(&val, array + (csize & ~3), csize & 3);
+			pm8001_cw32(pm8001_ha, 2, doffset + (csize & ~3), val);
 		}
+		/* flush the posted writes before the window moves */
+		pm8001_cr32(pm8001_ha, 2, doffset);
 
 		alen -= csize;
 		dbase += SIZE_64KB;
 		doffset = 0;
 		array = array + csize;
-	} while (alen != 0);
-
-	if (-1 == pm8001_bar4_shift(pm8001_ha, 0x0)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-		return 0;
 	}
-	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-
-	return 1;
-}
-
-static u32 pm8001_bar4_cpy_big(struct pm8001_hba_info *pm8001_ha,
-	u32 base, u32 offset, const unsigned char array[], u32 alen)
-{
-	u32	dbase;
-	u32	doffset;
-	u32	*larray;
-	u32	val;
-	u32	csize;
-	u32	wc;
-	u32	i = 0;
-	u8 *local_buffer = NULL;
-	unsigned long flags;
-
-	PM8001_INIT_DBG(pm8001_ha,
-		pm8001_printk("alen = 0x%x\n", alen));
-
-	dbase = (base+offset) & MB3_SHIFT_MASK;
-	doffset = offset & MB3_OFFSET_MASK;
-	spin_lock_irqsave(&pm8001_ha->lock, flags);
-	do {
-		if (-1 == pm8001_bar4_shift(pm8001_ha, dbase)) {
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-			return 0;
-		}
-
-		if ((doffset+alen) > SIZE_64KB)
-			csize = SIZE_64KB - doffset;
-		else
-			csize = alen;
 
+	if (-1 == pm8001_bar4_shift(pm8001_ha, 0x0))
+		ret = 0;
+	mutex_unlock(&pm8001_ha->bar4_mutex);
+	us = ktime_to_us(ktime_sub(ktime_get(), start));
+	if (ret)
 		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR dbase = 0x%x\n", dbase));
-		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR doffset = 0x%x\n", doffset));
-		PM8001_INIT_DBG(pm8001_ha,
-			pm8001_printk("ILA STR size = 0x%x\n", csize));
-
-		wc = ((csize % 4) > 0) ? ((csize / 4) + 1) : (csize / 4);
-		local_buffer = PMALLOC(csize, GFP_KERNEL);
-		if (local_buffer != NULL)
-			memcpy(local_buffer, array, csize);
-		larray = (u32 *)local_buffer;
-		for (i = 0; i < wc; i++) {
-			val = larray[i];
-			pm8001_cw32(pm8001_ha, 2, (doffset + (i*4)), val);
-		}
-		if(local_buffer != NULL)
-			PMFREE(local_buffer, csize);
-		alen -= csize;
-		dbase += SIZE_64KB;
-		doffset = 0;
-		array = array + csize;
-	} while (alen != 0);
-
-	if (-1 == pm8001_bar4_shift(pm8001_ha, 0x0)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-		return 0;
-	}
-	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-
-	return 1;
+			pm8001_printk("0x%x bytes in %lld us (%lld MB/s)\n",
+			total, (long long)us,
+			(long long)(us ? div64_s64(total, us) : 0)));
+	return ret;
 }
 
-
 static int pm8001_ishdar_idle(struct pm8001_hba_info *pm8001_ha)
 {
 	u32     hdaw;
@@ -2156,79 +2202,150 @@ static int pm8001_chip_in_hda_mode(struct pm8001_hba_info *pm8001_ha)
 static int
 pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature);
 
+/*
+ * HDA boot images, requested once and then shared by every HBA for probe,
+ * host reset and resume. Released at module unload.
+ */
+enum {
+	PM8001_HDA_ISTR,
+	PM8001_HDA_ILA,
+	PM8001_HDA_AAP1,
+	PM8001_HDA_IOP,
+	PM8001_HDA_IMAGES
+};
+
+static const char * const pm8001_hda_fw_name[PM8001_HDA_IMAGES] = {
+	"pm8001/istrimg.bin",
+	"pm8001/ilaimg.bin",
+	"pm8001/aap1img.bin",
+	"pm8001/iopimg.bin",
+};
+
+static DEFINE_MUTEX(pm8001_hda_fw_mutex);
+static const struct firmware *pm8001_hda_fw[PM8001_HDA_IMAGES];
+static int pm8001_hda_fw_cached;	/* pm8001_hda_fw_rc is the answer */
+static int pm8001_hda_fw_rc;
+
+/**
+ * pm8001_hda_fw_get - find the HDA boot images
+ * @pm8001_ha: our hba card information
+ *
+ * The first caller asks for the image files and caches the outcome, found
+ * or not, so resets and resumes do not wait on request_firmware() again.
+ * A missing istrimg.bin selects the images built into the driver. A miss
+ * is only asked again after pm8001_hda_fw_retry() or a module reload.
+ * Returns 1 for files, 0 for the built-in images, or a negative errno.
+ */
+static int pm8001_hda_fw_get(struct pm8001_hba_info *pm8001_ha)
+{
+	int i, rc;
+
+	mutex_lock(&pm8001_hda_fw_mutex);
+	if (pm8001_hda_fw_cached)
+		goto out;
+
+	pm8001_hda_fw_cached = 1;
+	pm8001_hda_fw_rc = 0;
+	if (request_firmware(&pm8001_hda_fw[PM8001_HDA_ISTR],
+			pm8001_hda_fw_name[PM8001_HDA_ISTR],
+			pm8001_ha->dev) != 0) {
+		pm8001_printk("Can not get istrimg.bin, load from header file\n");
+		pm8001_hda_fw[PM8001_HDA_ISTR] = NULL;
+		goto out;
+	}
+	for (i = PM8001_HDA_ISTR; i < PM8001_HDA_IMAGES; i++) {
+		if ((i != PM8001_HDA_ISTR) &&
+		    (request_firmware(&pm8001_hda_fw[i], pm8001_hda_fw_name[i],
+				pm8001_ha->dev) != 0)) {
+			pm8001_printk("Can not get %s\n",
+				pm8001_hda_fw_name[i]);
+			pm8001_hda_fw[i] = NULL;
+			goto err_out;
+		}
+		if (pm8001_hda_fw[i]->size == 0) {
+			pm8001_printk("%s is empty\n", pm8001_hda_fw_name[i]);
+			goto err_out;
+		}
+		pm8001_printk("Get %s, length is %zx\n",
+			pm8001_hda_fw_name[i], pm8001_hda_fw[i]->size);
+	}
+	pm8001_hda_fw_rc = 1;
+out:
+	rc = pm8001_hda_fw_rc;
+	mutex_unlock(&pm8001_hda_fw_mutex);
+	return rc;
+
+err_out:
+	for (i = PM8001_HDA_ISTR; i < PM8001_HDA_IMAGES; i++) {
+		release_firmware(pm8001_hda_fw[i]);
+		pm8001_hda_fw[i] = NULL;
+	}
+	pm8001_hda_fw_rc = -ENOENT;
+	goto out;
+}
+
+/**
+ * pm8001_hda_fw_retry - forget that the HDA boot images were not found
+ *
+ * Found images stay cached, HBAs may be booting from them.
+ */
+void pm8001_hda_fw_retry(void)
+{
+	mutex_lock(&pm8001_hda_fw_mutex);
+	if (pm8001_hda_fw_rc <= 0)
+		pm8001_hda_fw_cached = 0;
+	mutex_unlock(&pm8001_hda_fw_mutex);
+}
+
+/**
+ * pm8001_hda_fw_release - drop the cached HDA boot images
+ */
+void pm8001_hda_fw_release(void)
+{
+	int i;
+
+	mutex_lock(&pm8001_hda_fw_mutex);
+	for (i = PM8001_HDA_ISTR; i < PM8001_HDA_IMAGES; i++) {
+		release_firmware(pm8001_hda_fw[i]);
+		pm8001_hda_fw[i] = NULL;
+	}
+	pm8001_hda_fw_cached = 0;
+	pm8001_hda_fw_rc = 0;
+	mutex_unlock(&pm8001_hda_fw_mutex);
+}
+
 static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 {
-	int	i = 0;
 	u32	arga[6];
 	u32	reg;
 	u32	aap1_offset;
 	u32	fw_offset;
-	u32	pad1;
-	u32	pad2;
-	u8 *istr_buffer = NULL;
+	const u8 *istr_buffer = NULL;
 	u32 istr_length = 0;
-	u8 *ila_buffer = NULL;
+	const u8 *ila_buffer = NULL;
 	u32 ila_length = 0;
 	u32 aap1_length = 0;
 	u32 iop_length = 0;
-	u8 firmware_released = true;
 	u8 load_from_header = false;
+	int rc;
 
-	/*get initial string image*/
-	if (request_firmware(&pm8001_ha->fw_image, "pm8001/istrimg.bin",
-			pm8001_ha->dev) != 0) {
-		pm8001_printk("Can not get istrimg.bin, load from header file\n");
+	rc = pm8001_hda_fw_get(pm8001_ha);
+	if (rc < 0)
+		return 0;
+	if (rc == 0) {
 		load_from_header = true;
 	} else {
-		istr_length = pm8001_ha->fw_image->size;
-		pm8001_printk("Get istrimg.bin, length is %x\n", istr_length);
-		istr_buffer = PMALLOC(pm8001_ha->fw_image->size, GFP_KERNEL);
-		if (istr_buffer == NULL) {
-			release_firmware(pm8001_ha->fw_image);
-			goto err_out_hda;
-		}
-
-		memcpy(istr_buffer, pm8001_ha->fw_image->data, pm8001_ha->fw_image->size);
-		release_firmware(pm8001_ha->fw_image);
-	}
-
-	if (load_from_header == false) {
-		/*Get ILA image*/
-		if (request_firmware(&pm8001_ha->fw_image, "pm8001/ilaimg.bin",
-				pm8001_ha->dev) != 0) {
-			pm8001_printk("Can not get ilaimg.bin\n");
-			goto err_out_hda;
-		} else {
-			ila_length = pm8001_ha->fw_image->size;
-			pm8001_printk("Get ilaimg.bin, length is %x\n", ila_length);
-			ila_buffer = PMALLOC(pm8001_ha->fw_image->size, GFP_KERNEL);
-			if (ila_buffer == NULL) {
-				release_firmware(pm8001_ha->fw_image);
-				goto err_out_hda;
-			}
-
-			memcpy(ila_buffer, pm8001_ha->fw_image->data,
-				pm8001_ha->fw_image->size);
-			release_firmware(pm8001_ha->fw_image);
-		}
-
-		/*get aap1 image*/
-		if (request_firmware(&pm8001_ha->fw_image, "pm8001/aap1img.bin",
-				pm8001_ha->dev) != 0) {
-			pm8001_printk("Can not get aap1img.bin\n");
-			goto err_out_hda;
-		} else {
-			aap1_length = pm8001_ha->fw_image->size;
-			pm8001_printk("Get aap1img.bin, length is %x\n",
-				aap1_length);
-		}
-
-		firmware_released = false;
+		istr_buffer = pm8001_hda_fw[PM8001_HDA_ISTR]->data;
+		istr_length = pm8001_hda_fw[PM8001_HDA_ISTR]->size;
+		ila_buffer = pm8001_hda_fw[PM8001_HDA_ILA]->data;
+		ila_length = pm8001_hda_fw[PM8001_HDA_ILA]->size;
+		aap1_length = pm8001_hda_fw[PM8001_HDA_AAP1]->size;
+		iop_length = pm8001_hda_fw[PM8001_HDA_IOP]->size;
 	}
 
 	/* Try soft reset until it goes into HDA mode */
 	pm8001_chip_soft_rst(pm8001_ha, SPC_HDASOFT_RESET_SIGNATURE);
-	mdelay(10);
+	pm8001_poll_delay(10000);
 	if (!pm8001_ishdar_idle(pm8001_ha)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("SPC_HDASOFT_RESET: failed!\n"));
@@ -2240,14 +2357,8 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 	pm8001_cw32(pm8001_ha, 0, MSGU_ODMR, ODMR_CLEAR_ALL);
 
 	/* Step 1: Poll HDA_RSP_IDLE - HDA mode */
-	i = 0;
-	do {
-		mdelay(10);
-		if (pm8001_ishdar_idle(pm8001_ha))
-			break;
-		i++;
-	} while (i < 200);
-	if (i == 200) {
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_HDA_IDLE,
+			pm8001_ishdar_idle(pm8001_ha), 1000, 2000000)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("HDA Mode: Timeout!\n")); /* 2 sec */
 		goto err_out_hda;
@@ -2307,17 +2418,9 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 
 	/* Step 7: Poll ILAHDA_AAP1IMGGET/Offset in MSGU Scratchpad 0 */
 	/* Check MSGU Scratchpad 1 [1,0] == 00 */
-	i = 0;
-	do {
-		mdelay(10);
-		reg = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_0);
-		aap1_offset = reg & ~SCRATCH_PAD0_STATE_MASK;
-		reg = reg >> 24;
-		if (reg == ILA_HDA_AAP1_IMG_GET)
-			break;
-		i++;
-	} while (i < 200);
-	if (i == 200) {
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_HDA_AAP1,
+			((reg = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_0))
+			 >> 24) == ILA_HDA_AAP1_IMG_GET, 1000, 2000000)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("APP1_IMG_GET Poll timeout !\n"));
 		reg = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1);
@@ -2329,21 +2432,16 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 
 		goto err_out_hda;
 	}
+	aap1_offset = reg & ~SCRATCH_PAD0_STATE_MASK;
 	PM8001_INIT_DBG(pm8001_ha, pm8001_printk("APP1 img get ok!\n"));
 
 	/* Step 8: Copy AAP1 image, update the Host Scratchpad 3 */
 	if (load_from_header == false) {
 		reg = (ILA_HDA_AAP1_IMG_DONE << 24) | aap1_length;
-		if (!pm8001_bar4_cpy_big(pm8001_ha, GSM_HDA_ILA_BASE,
-				aap1_offset, pm8001_ha->fw_image->data,
-				aap1_length)) {
-			release_firmware(pm8001_ha->fw_image);
-			firmware_released = true;
+		if (!pm8001_bar4_cpy(pm8001_ha, GSM_HDA_ILA_BASE,
+				aap1_offset, pm8001_hda_fw[PM8001_HDA_AAP1]->data,
+				aap1_length))
 			goto err_out_hda;
-		} else {
-			release_firmware(pm8001_ha->fw_image);
-			firmware_released = true;
-		}
 	} else {
 		reg = (ILA_HDA_AAP1_IMG_DONE << 24) | (u32)sizeof(aap1array);
 		if (!pm8001_bar4_cpy(pm8001_ha, GSM_HDA_ILA_BASE,
@@ -2354,51 +2452,24 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 
 	pm8001_cw32(pm8001_ha, 0, MSGU_HOST_SCRATCH_PAD_3, reg);
 
-
-	/*Get IOP image*/
-	if (load_from_header == false) {
-		if (request_firmware(&pm8001_ha->fw_image, "pm8001/iopimg.bin",
-				pm8001_ha->dev) != 0) {
-			pm8001_printk("Can not get istrimg.bin\n");
-			goto err_out_hda;
-		} else {
-			iop_length = pm8001_ha->fw_image->size;
-			pm8001_printk("Get iopimg.bin, length is %x\n", iop_length);
-			firmware_released = false;
-		}
-	}
-
 	/* Step 9: Poll ILAHDA_IOPIMGGET/Offset in MSGU Scratchpad 0 */
-	i = 0;
-	do {
-		mdelay(10);
-		reg = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_0);
-		fw_offset = reg & ~SCRATCH_PAD0_STATE_MASK;
-		reg = reg >> 24;
-		if (reg == ILA_HDA_IOP_IMG_GET)
-			break;
-		i++;
-	} while (i < 200);
-	if (i == 200) {
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_HDA_IOP,
+			((reg = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_0))
+			 >> 24) == ILA_HDA_IOP_IMG_GET, 1000, 2000000)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("IOP_IMG_GET Poll timeout !\n"));
 
 		goto err_out_hda;
 	}
+	fw_offset = reg & ~SCRATCH_PAD0_STATE_MASK;
 	PM8001_INIT_DBG(pm8001_ha, pm8001_printk("IOP img get ok!\n"));
 
 	/* Step 10: Copy IOP image, update the Host Scratchpad 3 */
 	if (load_from_header == false) {
 		reg = (ILA_HDA_IOP_IMG_DONE << 24) | iop_length;
-		if (!pm8001_bar4_cpy_big(pm8001_ha, GSM_HDA_ILA_BASE, fw_offset,
-				pm8001_ha->fw_image->data, iop_length)) {
-			release_firmware(pm8001_ha->fw_image);
-			firmware_released = true;
+		if (!pm8001_bar4_cpy(pm8001_ha, GSM_HDA_ILA_BASE, fw_offset,
+				pm8001_hda_fw[PM8001_HDA_IOP]->data, iop_length))
 			goto err_out_hda;
-		} else {
-			release_firmware(pm8001_ha->fw_image);
-			firmware_released = true;            
-		}
 	} else {
 		reg = (ILA_HDA_IOP_IMG_DONE << 24) | (u32)sizeof(ioparray); 
 		if (!pm8001_bar4_cpy(pm8001_ha, GSM_HDA_ILA_BASE, 
@@ -2414,19 +2485,11 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 
 	/* step 11: wait for the FW and IOP to get ready - 1 sec timeout */
 	/* Wait for the SPC Configuration Table to be ready */
-	i = 0;
-	do {
-		mdelay(10);
-		pad1 = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1);
-		if (pad1 & SCRATCH_PAD1_RDY) {
-			pad2 = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2);
-			if (pad2 & SCRATCH_PAD2_RDY)
-				break;
-		}
-		i++;
-	} while (i < 200);
-
-	if (i == 200) {
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_HDA_READY,
+			(pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1)
+			 & SCRATCH_PAD1_RDY)
+			&& (pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2)
+			 & SCRATCH_PAD2_RDY), 1000, 2000000)) {
 		PM8001_INIT_DBG(pm8001_ha,
 			pm8001_printk("PAD 1 & 2 not Rdy !\n"));
 
@@ -2434,23 +2497,9 @@ static int pm8001_chip_hda_mode(struct pm8001_hba_info *pm8001_ha)
 	}
 	PM8001_INIT_DBG(pm8001_ha, pm8001_printk("HDA Mode Complete!\n"));
 
-	if (istr_buffer != NULL)
-		PMFREE(istr_buffer, istr_length);
-	if (ila_buffer != NULL)
-		PMFREE(ila_buffer, ila_length);
-	if (firmware_released == false)
-		release_firmware(pm8001_ha->fw_image);
-
 	return 1;
 
 err_out_hda:
-	if (istr_buffer != NULL)
-		PMFREE(istr_buffer, istr_length);
-	if (ila_buffer != NULL)
-		PMFREE(ila_buffer, ila_length);
-	if (firmware_released == false)
-		release_firmware(pm8001_ha->fw_image);
-
 	return 0;
 }
 
@@ -2464,6 +2513,8 @@ static void pm8001_chip_interrupt_disable(struct pm8001_hba_info *pm8001_ha);
  */
 static int pm8001_chip_init(struct pm8001_hba_info *pm8001_ha)
 {
+	int i;
+
 	/* check the firmware status */
 	if ((pm8001_ha->rst_signature != SPC_HDASOFT_RESET_SIGNATURE)
 	 && (-1 == check_fw_ready(pm8001_ha))) {
@@ -2489,8 +2540,10 @@ static int pm8001_chip_init(struct pm8001_hba_info *pm8001_ha)
 	read_outbnd_queue_table(pm8001_ha);
 	/* update main config table ,inbound table and outbound table */
 	pm8001_update_main_config_table(pm8001_ha);
-	update_inbnd_queue_table(pm8001_ha, 0);
-	update_outbnd_queue_table(pm8001_ha, 0);
+	for (i = 0; i < PM8001_MAX_INB_NUM; i++)
+		update_inbnd_queue_table(pm8001_ha, i);
+	for (i = 0; i < PM8001_MAX_OUTB_NUM; i++)
+		update_outbnd_queue_table(pm8001_ha, i);
 	mpi_set_phys_g3_with_ssc(pm8001_ha, 0);
 	/* 7->130ms, 34->500ms, 119->1.5s */
 	mpi_set_open_retry_interval_reg(pm8001_ha, 119);
@@ -2515,9 +2568,8 @@ static int pm8001_chip_init(struct pm8001_hba_info *pm8001_ha)
 
 static int mpi_uninit_check(struct pm8001_hba_info *pm8001_ha)
 {
-	u32 max_wait_count;
-	u32 value;
-	u32 gst_len_mpistate;
+	u32 value = 0;
+	u32 gst_len_mpistate = 0;
 
 	if (init_pci_device_addresses(pm8001_ha)) {
 		return -1;
@@ -2527,33 +2579,22 @@ static int mpi_uninit_check(struct pm8001_hba_info *pm8001_ha)
 	table is stop */
 	pm8001_cw32(pm8001_ha, 0, MSGU_IBDB_SET, SPC_MSGU_CFG_TABLE_RESET);
 
-	/* wait until Inbound DoorBell Clear Register toggled */
-	max_wait_count = 1 * 1000 * 1000;/* 1 sec */
-	do {
-		udelay(1);
-		value = pm8001_cr32(pm8001_ha, 0, MSGU_IBDB_SET);
-		value &= SPC_MSGU_CFG_TABLE_RESET;
-	} while ((value != 0) && (--max_wait_count));
-
-	if (!max_wait_count) {
+	/* wait until Inbound DoorBell Clear Register toggled - 1 sec */
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_MPI_UNINIT,
+			!((value = pm8001_cr32(pm8001_ha, 0, MSGU_IBDB_SET))
+			  & SPC_MSGU_CFG_TABLE_RESET), 20, 1000000)) {
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("TIMEOUT:IBDB value/=0x%x\n", value));
 		return -1;
 	}
 
-	/* check the MPI-State for termination in progress */
-	/* wait until Inbound DoorBell Clear Register toggled */
-	max_wait_count = 1 * 1000 * 1000;  /* 1 sec */
-	do {
-		udelay(1);
-		gst_len_mpistate =
-			pm8001_mr32(pm8001_ha->general_stat_tbl_addr,
-			GST_GSTLEN_MPIS_OFFSET);
-		if (GST_MPI_STATE_UNINIT ==
-			(gst_len_mpistate & GST_MPI_STATE_MASK))
-			break;
-	} while (--max_wait_count);
-	if (!max_wait_count) {
+	/* check the MPI-State for termination in progress - 1 sec */
+	if (pm8001_poll(pm8001_ha, PM8001_PHASE_MPI_STOP,
+			GST_MPI_STATE_UNINIT ==
+			((gst_len_mpistate =
+			  pm8001_mr32(pm8001_ha->general_stat_tbl_addr,
+			  GST_GSTLEN_MPIS_OFFSET)) & GST_MPI_STATE_MASK),
+			20, 1000000)) {
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk(" TIME OUT MPI State = 0x%x\n",
 				gst_len_mpistate & GST_MPI_STATE_MASK));
@@ -2590,12 +2631,11 @@ static u32 soft_reset_ready_check(struct pm8001_hba_info *pm8001_ha)
 			 */
 			;
 		} else {
-			unsigned long flags;
 			/* Trigger NMI twice via RB6 */
-			spin_lock_irqsave(&pm8001_ha->lock, flags);
+			mutex_lock(&pm8001_ha->bar4_mutex);
 			if (-1 == pm8001_bar4_shift(pm8001_ha,
 					RB6_ACCESS_REG)) {
-				spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+				mutex_unlock(&pm8001_ha->bar4_mutex);
 				PM8001_FAIL_DBG(pm8001_ha,
 					pm8001_printk("Shift Bar4 to 0x%x "
 						"failed\n",
@@ -2606,11 +2646,13 @@ static u32 soft_reset_ready_check(struct pm8001_hba_info *pm8001_ha)
 				RB6_MAGIC_NUMBER_RST);
 			pm8001_cw32(pm8001_ha, 2, SPC_RB6_OFFSET,
 				RB6_MAGIC_NUMBER_RST);
-			/* wait for 100 ms */
-			mdelay(100);
-			regVal = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_2) &
-				SCRATCH_PAD2_FWRDY_RST;
-			if (regVal != SCRATCH_PAD2_FWRDY_RST) {
+			/* wait up to 100 ms */
+			if (pm8001_poll(pm8001_ha, PM8001_PHASE_RST_NMI,
+					(pm8001_cr32(pm8001_ha, 0,
+					  MSGU_SCRATCH_PAD_2)
+					 & SCRATCH_PAD2_FWRDY_RST)
+					== SCRATCH_PAD2_FWRDY_RST,
+					1000, 100000)) {
 				regVal1 = pm8001_cr32(pm8001_ha, 0,
 					MSGU_SCRATCH_PAD_1);
 				regVal2 = pm8001_cr32(pm8001_ha, 0,
@@ -2630,10 +2672,10 @@ static u32 soft_reset_ready_check(struct pm8001_hba_info *pm8001_ha)
 						"value = 0x%x\n",
 						pm8001_cr32(pm8001_ha, 0,
 							MSGU_SCRATCH_PAD_3)));
-				spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+				mutex_unlock(&pm8001_ha->bar4_mutex);
 				return -1;
 			}
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			mutex_unlock(&pm8001_ha->bar4_mutex);
 		}
 	}
 	return 0;
@@ -2649,9 +2691,7 @@ static int
 pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 {
 	u32	regVal, toggleVal;
-	u32	max_wait_count;
 	u32	regVal1, regVal2, regVal3;
-	unsigned long flags;
 
 	/* step1: Check FW is ready for soft reset */
 	soft_reset_ready_check(pm8001_ha);
@@ -2659,9 +2699,9 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	/* step 2: clear NMI status register on AAP1 and IOP, write the same
 	value to clear */
 	/* map 0x60000 to BAR4(0x20), BAR2(win) */
-	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	mutex_lock(&pm8001_ha->bar4_mutex);
 	if (-1 == pm8001_bar4_shift(pm8001_ha, MBIC_AAP1_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("Shift Bar4 to 0x%x failed\n",
 			MBIC_AAP1_ADDR_BASE));
@@ -2673,7 +2713,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	pm8001_cw32(pm8001_ha, 2, MBIC_NMI_ENABLE_VPE0_IOP, 0x0);
 	/* map 0x70000 to BAR4(0x20), BAR2(win) */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, MBIC_IOP_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("Shift Bar4 to 0x%x failed\n",
 			MBIC_IOP_ADDR_BASE));
@@ -2716,7 +2756,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	/* read required registers for confirmming */
 	/* map 0x0700000 to BAR4(0x20), BAR2(win) */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, GSM_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("Shift Bar4 to 0x%x failed\n",
 			GSM_ADDR_BASE));
@@ -2783,7 +2823,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	udelay(10);
 	/* step 5-b: set GPIO-0 output control to tristate anyway */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, GPIO_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_INIT_DBG(pm8001_ha,
 				pm8001_printk("Shift Bar4 to 0x%x failed\n",
 				GPIO_ADDR_BASE));
@@ -2800,7 +2840,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	/* Step 6: Reset the IOP and AAP1 */
 	/* map 0x00000 to BAR4(0x20), BAR2(win) */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, SPC_TOP_LEVEL_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("SPC Shift Bar4 to 0x%x failed\n",
 			SPC_TOP_LEVEL_ADDR_BASE));
@@ -2838,7 +2878,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	/* step 11: reads and sets the GSM Configuration and Reset Register */
 	/* map 0x0700000 to BAR4(0x20), BAR2(win) */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, GSM_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("SPC Shift Bar4 to 0x%x failed\n",
 			GSM_ADDR_BASE));
@@ -2892,7 +2932,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	/* step 13: bring the IOP and AAP1 out of reset */
 	/* map 0x00000 to BAR4(0x20), BAR2(win) */
 	if (-1 == pm8001_bar4_shift(pm8001_ha, SPC_TOP_LEVEL_ADDR_BASE)) {
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("Shift Bar4 to 0x%x failed\n",
 			SPC_TOP_LEVEL_ADDR_BASE));
@@ -2906,19 +2946,15 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 	if (signature == SPC_SOFT_RESET_SIGNATURE)
 		udelay(10);
 	else
-		mdelay(200);
+		pm8001_settle(pm8001_ha, PM8001_PHASE_RST_SETTLE, 200000);
 	/* check Soft Reset Normal mode or Soft Reset HDA mode */
 	if (signature == SPC_SOFT_RESET_SIGNATURE) {
 		/* step 15 (Normal Mode): wait until scratch pad1 register
 		bit 2 toggled */
-		max_wait_count = 2 * 1000 * 1000;/* 2 sec */
-		do {
-			udelay(1);
-			regVal = pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1) &
-				SCRATCH_PAD1_RST;
-		} while ((regVal != toggleVal) && (--max_wait_count));
-
-		if (!max_wait_count) {
+		if (pm8001_poll(pm8001_ha, PM8001_PHASE_RST_TOGGLE,
+				(pm8001_cr32(pm8001_ha, 0, MSGU_SCRATCH_PAD_1)
+				 & SCRATCH_PAD1_RST) == toggleVal,
+				20, 2000000)) {
 			regVal = pm8001_cr32(pm8001_ha, 0,
 				MSGU_SCRATCH_PAD_1);
 			PM8001_FAIL_DBG(pm8001_ha,
@@ -2937,7 +2973,7 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 				pm8001_printk("SCRATCH_PAD3 value = 0x%x\n",
 				pm8001_cr32(pm8001_ha, 0,
 				MSGU_SCRATCH_PAD_3)));
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			mutex_unlock(&pm8001_ha->bar4_mutex);
 			return -1;
 		}
 
@@ -2967,12 +3003,12 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 				pm8001_printk("SCRATCH_PAD3 value = 0x%x\n",
 				pm8001_cr32(pm8001_ha, 0,
 				MSGU_SCRATCH_PAD_3)));
-			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			mutex_unlock(&pm8001_ha->bar4_mutex);
 			return -1;
 		}
 	}
 	pm8001_bar4_shift(pm8001_ha, 0);
-	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	mutex_unlock(&pm8001_ha->bar4_mutex);
 
 	PM8001_INIT_DBG(pm8001_ha,
 		pm8001_printk("SPC soft reset Complete\n"));
@@ -2981,7 +3017,6 @@ pm8001_chip_soft_rst(struct pm8001_hba_info *pm8001_ha, u32 signature)
 
 static void pm8001_hw_chip_rst(struct pm8001_hba_info *pm8001_ha)
 {
-	u32 i;
 	u32 regVal;
 	PM8001_INIT_DBG(pm8001_ha,
 		pm8001_printk("chip reset start\n"));
@@ -3003,10 +3038,7 @@ static void pm8001_hw_chip_rst(struct pm8001_hba_info *pm8001_ha)
 	udelay(10);
 
 	/* wait for 20 msec until the firmware gets reloaded */
-	i = 20;
-	do {
-		mdelay(1);
-	} while ((--i) != 0);
+	pm8001_poll_delay(20000);
 
 	PM8001_INIT_DBG(pm8001_ha,
 		pm8001_printk("chip reset finished\n"));
@@ -3123,7 +3155,8 @@ pm8001_chip_interrupt_disable(struct pm8001_hba_info *pm8001_ha)
 /**
  * mpi_msg_free_get- get the free message buffer for transfer inbound queue.
  * @circularQ: the inbound queue  we want to transfer to HBA.
- * @messageSize: the message size of this transfer, normally it is 64 bytes
+ * @messageSize: the message size of this transfer, normally it is 64 bytes,
+ * larger messages take consecutive elements
  * @messagePtr: the pointer to message.
  */
 static int mpi_msg_free_get(struct inbound_queue_table *circularQ,
@@ -3131,10 +3164,10 @@ static int mpi_msg_free_get(struct inbound_queue_table *circularQ,
 {
 	u32 offset, consumer_index;
 	struct mpi_msg_hdr *msgHeader;
-	u8 bcCount = 1; /* only support single buffer */
+	u8 bcCount = DIV_ROUND_UP(messageSize, 64);
 
 	/* Checks is the requested message size can be allocated in this queue*/
-	if (messageSize > 64) {
+	if (messageSize > 128) {
 		*messagePtr = NULL;
 		return -1;
 	}
@@ -3142,8 +3175,8 @@ static int mpi_msg_free_get(struct inbound_queue_table *circularQ,
 	/* Stores the new consumer index */
 	consumer_index = pm8001_read_32(circularQ->ci_virt);
 	circularQ->consumer_index = cpu_to_le32(consumer_index);
-	if (((circularQ->producer_idx + bcCount) % PM8001_MPI_QUEUE) ==
-		le32_to_cpu(circularQ->consumer_index)) {
+	if (((le32_to_cpu(circularQ->consumer_index) + PM8001_MPI_QUEUE
+		- circularQ->producer_idx - 1) % PM8001_MPI_QUEUE) < bcCount) {
 		*messagePtr = NULL;
 		return -1;
 	}
@@ -3160,26 +3193,29 @@ static int mpi_msg_free_get(struct inbound_queue_table *circularQ,
 }
 
 /**
- * mpi_build_cmd- build the message queue for transfer, update the PI to FW
+ * mpi_build_iomb- build the message queue for transfer, update the PI to FW
  * to tell the fw to get this message from IOMB.
  * @pm8001_ha: our hba card information
  * @circularQ: the inbound queue we want to transfer to HBA.
  * @opCode: the operation code represents commands which LLDD and fw recognized.
  * @payload: the command payload of each operation command.
+ * @size: the IOMB size, a multiple of the 64 byte queue element.
  */
-static int mpi_build_cmd(struct pm8001_hba_info *pm8001_ha,
+static int mpi_build_iomb(struct pm8001_hba_info *pm8001_ha,
 			 int tag,
 			 struct inbound_queue_table *circularQ,
-			 u32 opCode, void *payload)
+			 u32 opCode, void *payload, u16 size)
 {
 	struct pm8001_ccb_info *ccb = get_ccb_array(pm8001_ha, tag);
-	u32 Header = 0, hpriority = 0, bc = 1, category = 0x02;
-	u32 responseQueue = 0;
+	u32 Header = 0, bc = size / 64, category = 0x02;
+	u32 hpriority = circularQ->hpriority;
+	u32 responseQueue = circularQ->response_queue;
 	void *pMessage;
+	u32 i, idx;
 
 	BUG_ON(ccb->ccb_tag != tag);
 
-	if (mpi_msg_free_get(circularQ, 64, &pMessage) < 0) {
+	if (mpi_msg_free_get(circularQ, size, &pMessage) < 0) {
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("No free mpi buffer\n"));
 		return -ENOMEM;
@@ -3187,6 +3223,13 @@ static int mpi_build_cmd(struct pm8001_hba_info *pm8001_ha,
 	BUG_ON(!payload);
 	/*Copy to the payload*/
 	memcpy(pMessage, payload, (64 - sizeof(struct mpi_msg_hdr)));
+	/* the following elements may wrap to the start of the queue */
+	idx = (pMessage - sizeof(struct mpi_msg_hdr) - circularQ->base_virt)
+		/ 64;
+	for (i = 1; i < bc; i++)
+		memcpy(circularQ->base_virt
+			+ ((idx + i) % PM8001_MPI_QUEUE) * 64,
+			payload + i * 64 - sizeof(struct mpi_msg_hdr), 64);
 
 	/*Build the header*/
 	Header = ((1 << 31) | (hpriority << 30) | ((bc & 0x1f) << 24)
@@ -3204,6 +3247,17 @@ static int mpi_build_cmd(struct pm8001_hba_info *pm8001_ha,
 	return 0;
 }
 
+/**
+ * mpi_build_cmd- build a single element IOMB, see mpi_build_iomb.
+ */
+static int mpi_build_cmd(struct pm8001_hba_info *pm8001_ha,
+			 int tag,
+			 struct inbound_queue_table *circularQ,
+			 u32 opCode, void *payload)
+{
+	return mpi_build_iomb(pm8001_ha, tag, circularQ, opCode, payload, 64);
+}
+
 static u32 mpi_msg_free_set(struct pm8001_hba_info *pm8001_ha, void *pMsg,
 			    struct outbound_queue_table *circularQ, u8 bc)
 {
@@ -3331,20 +3385,25 @@ static void pm8001_work_fn(PMCS_WORK_ARG work)
 	struct domain_device *dev;
 
 	/*
-	 * So far, all users of this stash an associated structure here.
-	 * If we get here, and this pointer is null, then the action
-	 * was cancelled. This nullification happens when the device
-	 * goes away.
+	 * All users but PM8001_WORK_PORT_LOST, which has no data, stash an
+	 * associated structure here. If we get here, and this pointer is
+	 * null, then the action was cancelled. This nullification happens
+	 * when the device goes away.
 	 */
 	pm8001_dev = pw->data; /* Most stash device structure */
-	if ((pm8001_dev == NULL)
-	 || ((pw->handler != IO_XFER_ERROR_BREAK)
-	  && (pm8001_dev->dev_type == SAS_PHY_UNUSED))) {
+	if ((pw->handler != PM8001_WORK_PORT_LOST)
+	 && ((pm8001_dev == NULL)
+	  || ((pw->handler != IO_XFER_ERROR_BREAK)
+	   && (pm8001_dev->dev_type == SAS_PHY_UNUSED)))) {
 		PMFREE(pw, sizeof(*pw));
 		return;
 	}
 
 	switch (pw->handler) {
+	case PM8001_WORK_PORT_LOST:
+		/* pm8001_port_lost has marked the devices */
+		pm8001_abort_lost_devices(pw->pm8001_ha);
+		break;
 	case IO_XFER_ERROR_BREAK:
 	{	/* This one stashes the sas_task instead */
 		struct sas_task *t = (struct sas_task *)pm8001_dev;
@@ -3669,6 +3728,71 @@ mpi_status_string(u32 status)
 	return buffer;
 }
 
+/*
+ * Hand a finished SSP task back to libsas, for both the fast and the
+ * slow path of mpi_ssp_completion. HA lock is held.
+ */
+static inline void
+mpi_ssp_task_done(struct pm8001_hba_info *pm8001_ha, struct sas_task *t,
+	struct pm8001_ccb_info *ccb, u32 tag, u32 status)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->task_state_lock, flags);
+	t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
+	t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
+	t->task_state_flags |= SAS_TASK_STATE_DONE;
+	if (unlikely((t->task_state_flags & SAS_TASK_STATE_ABORTED))) {
+		spin_unlock_irqrestore(&t->task_state_lock, flags);
+		PM8001_FAIL_DBG(pm8001_ha, pm8001_printk("task 0x%p done with"
+			" status %s resp 0x%x "
+			"stat 0x%x but aborted by upper layer!\n",
+			t, mpi_status_string(status), t->task_status.resp,
+			t->task_status.stat));
+		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
+	} else {
+		spin_unlock_irqrestore(&t->task_state_lock, flags);
+		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
+		mb();/* in order to force CPU ordering */
+		t->task_done(t);
+	}
+}
+
+/*
+ * Report a failed SSP command. Kept out of line and off the completion
+ * path's cache lines, and rate limited, as a dying disk fails a lot.
+ */
+static noinline void __cold
+mpi_ssp_completion_diag(struct pm8001_hba_info *pm8001_ha, struct sas_task *t,
+	u32 status, u32 tag, u32 param)
+{
+	if (!(pm8001_ha->logging_level & PM8001_FAIL_LOGGING)
+	 || !printk_ratelimit())
+		return;
+	/* TMFs come back here too, without a scsi command */
+	if (t && t->dev && t->ssp_task.cmd) {
+		pm8001_printk("SSP IO status %s tag 0x%x "
+			"dlen=%u param=0x%x\n"
+			"wwn=%016llx  cdb=%02x %02x %02x %02x %02x %02x %02x "
+			"%02x %02x %02x %02x "
+			"%02x %02x %02x %02x %02x\n",
+			mpi_status_string(status), tag, t->total_xfer_len,
+			param, SAS_ADDR(t->dev->sas_addr),
+			t->ssp_task.cmd->cmnd[0] & 0xff, t->ssp_task.cmd->cmnd[1] & 0xff,
+			t->ssp_task.cmd->cmnd[2] & 0xff, t->ssp_task.cmd->cmnd[3] & 0xff,
+			t->ssp_task.cmd->cmnd[4] & 0xff, t->ssp_task.cmd->cmnd[5] & 0xff,
+			t->ssp_task.cmd->cmnd[6] & 0xff, t->ssp_task.cmd->cmnd[7] & 0xff,
+			t->ssp_task.cmd->cmnd[8] & 0xff, t->ssp_task.cmd->cmnd[9] & 0xff,
+			t->ssp_task.cmd->cmnd[10] & 0xff, t->ssp_task.cmd->cmnd[11] & 0xff,
+			t->ssp_task.cmd->cmnd[12] & 0xff, t->ssp_task.cmd->cmnd[13] & 0xff,
+			t->ssp_task.cmd->cmnd[14] & 0xff,
+			t->ssp_task.cmd->cmnd[15] & 0xff);
+	} else {
+		pm8001_printk("SSP IO status %s tag 0x%x\n",
+			mpi_status_string(status), tag);
+	}
+}
+
 /**
  * mpi_ssp_completion- process the event that FW response to the SSP request.
  * @pm8001_ha: our hba card information
@@ -3685,7 +3809,6 @@ mpi_ssp_completion(struct pm8001_hba_info *pm8001_ha , void *piomb)
 {
 	struct sas_task *t;
 	struct pm8001_ccb_info *ccb;
-	unsigned long flags;
 	u32 status;
 	u32 param;
 	u32 tag;
@@ -3713,33 +3836,30 @@ mpi_ssp_completion(struct pm8001_hba_info *pm8001_ha , void *piomb)
 		return;
 	}
 	pm8001_dev = ccb->device;
-	param = le32_to_cpu(psspPayload->param);
-
 	t = ccb->task;
-
-	if (status && status != IO_UNDERFLOW && t && t->dev) {
-		PM8001_FAIL_DBG(pm8001_ha,
-			pm8001_printk("SSP IO status %s tag 0x%x "
-			"dlen=%u param=0x%x\n"
-			"wwn=%016llx  cdb=%02x %02x %02x %02x %02x %02x %02x "
-			"%02x %02x %02x %02x "
-			"%02x %02x %02x %02x %02x\n",
-			mpi_status_string(status), tag, t->total_xfer_len,
-			param, SAS_ADDR(t->dev->sas_addr),
-			t->ssp_task.cmd->cmnd[0] & 0xff, t->ssp_task.cmd->cmnd[1] & 0xff,
-			t->ssp_task.cmd->cmnd[2] & 0xff, t->ssp_task.cmd->cmnd[3] & 0xff,
-			t->ssp_task.cmd->cmnd[4] & 0xff, t->ssp_task.cmd->cmnd[5] & 0xff,
-			t->ssp_task.cmd->cmnd[6] & 0xff, t->ssp_task.cmd->cmnd[7] & 0xff,
-			t->ssp_task.cmd->cmnd[8] & 0xff, t->ssp_task.cmd->cmnd[9] & 0xff,
-			t->ssp_task.cmd->cmnd[10] & 0xff, t->ssp_task.cmd->cmnd[11] & 0xff,
-			t->ssp_task.cmd->cmnd[12] & 0xff, t->ssp_task.cmd->cmnd[13] & 0xff,
-			t->ssp_task.cmd->cmnd[14] & 0xff,
-			t->ssp_task.cmd->cmnd[15] & 0xff));
-	} else if (status && status != IO_UNDERFLOW) {
-		PM8001_FAIL_DBG(pm8001_ha,
-			pm8001_printk("SSP IO status %s tag 0x%x\n",
-				mpi_status_string(status), tag));
+	/*
+	 * Fast path: good status, or an underrun which is no more than a
+	 * short transfer; neither needs the response IU nor any logging.
+	 */
+	if (likely(((status == IO_SUCCESS) && (psspPayload->param == 0))
+	 || (status == IO_UNDERFLOW)) && likely(t && t->lldd_task && t->dev)) {
+		DEC_REQ(pm8001_dev, pm8001_ha);
+		ts = &t->task_status;
+		ts->resp = SAS_TASK_COMPLETE;
+		if (status == IO_SUCCESS) {
+			pm8001_dev->orej = 0;
+			ts->stat = SAM_STAT_GOOD;
+		} else {
+			ts->stat = SAS_DATA_UNDERRUN;
+			ts->residual = le32_to_cpu(psspPayload->param);
+		}
+		mpi_ssp_task_done(pm8001_ha, t, ccb, tag, status);
+		return;
 	}
+	param = le32_to_cpu(psspPayload->param);
+
+	if (status && status != IO_UNDERFLOW)
+		mpi_ssp_completion_diag(pm8001_ha, t, status, tag, param);
 	DEC_REQ(pm8001_dev, pm8001_ha);
 	if (unlikely(!t || !t->lldd_task || !t->dev)) {
 		PM8001_FAIL_DBG(pm8001_ha,
@@ -3929,6 +4049,21 @@ mpi_ssp_completion(struct pm8001_hba_info *pm8001_ha , void *piomb)
 		ts->stat = SAS_OPEN_REJECT;
 		ts->open_rej_reason = SAS_OREJ_RSVD_RETRY;
 		break;
+	case IO_EDC_IN_ERROR:
+	case IO_EDC_OUT_ERROR:
+		/*
+		 * The FW does not say which tag failed to check, so report
+		 * it as the guard; the data is bad either way.
+		 */
+		PM8001_IO_DBG(pm8001_ha,
+			pm8001_printk("%s\n", mpi_status_string(status)));
+		ts->resp = SAS_TASK_COMPLETE;
+		ts->stat = SAM_STAT_CHECK_CONDITION;
+		ts->buf_valid_size = min_t(int, SAS_STATUS_BUF_SIZE,
+			SCSI_SENSE_BUFFERSIZE);
+		scsi_build_sense_buffer(0, ts->buf, ABORTED_COMMAND,
+			0x10, 0x01);
+		break;
 	default:
 		PM8001_IO_DBG(pm8001_ha,
 			pm8001_printk("Unknown status %s\n",
@@ -3953,23 +4088,7 @@ mpi_ssp_completion(struct pm8001_hba_info *pm8001_ha , void *piomb)
 	PM8001_IO_DBG(pm8001_ha,
 		pm8001_printk("scsi_status = %x\n",
 		psspPayload->ssp_resp_iu.status));
-	spin_lock_irqsave(&t->task_state_lock, flags);
-	t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
-	t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
-	t->task_state_flags |= SAS_TASK_STATE_DONE;
-	if (unlikely((t->task_state_flags & SAS_TASK_STATE_ABORTED))) {
-		spin_unlock_irqrestore(&t->task_state_lock, flags);
-		PM8001_FAIL_DBG(pm8001_ha, pm8001_printk("task 0x%p done with"
-			" status %s resp 0x%x "
-			"stat 0x%x but aborted by upper layer!\n",
-			t, mpi_status_string(status), ts->resp, ts->stat));
-		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
-	} else {
-		spin_unlock_irqrestore(&t->task_state_lock, flags);
-		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
-		mb();/* in order to force CPU ordering */
-		t->task_done(t);
-	}
+	mpi_ssp_task_done(pm8001_ha, t, ccb, tag, status);
 }
 
 /*See the comments for mpi_ssp_completion */
@@ -4188,6 +4307,38 @@ static void mpi_ssp_event(struct pm8001_hba_info *pm8001_ha , void *piomb)
 	}
 }
 
+/*
+ * Hand a finished SATA task back to libsas, for both the fast and the
+ * slow path of mpi_sata_completion. HA lock is held.
+ */
+static inline void
+mpi_sata_task_done(struct pm8001_hba_info *pm8001_ha, struct sas_task *t,
+	struct pm8001_ccb_info *ccb, u32 tag, u32 status)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&t->task_state_lock, flags);
+	t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
+	t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
+	t->task_state_flags |= SAS_TASK_STATE_DONE;
+	if (unlikely((t->task_state_flags & SAS_TASK_STATE_ABORTED))) {
+		spin_unlock_irqrestore(&t->task_state_lock, flags);
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("task 0x%p done with status %s"
+			" resp 0x%x stat 0x%x but aborted by upper layer!\n",
+			t, mpi_status_string(status), t->task_status.resp,
+			t->task_status.stat));
+		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
+		return;
+	}
+	spin_unlock_irqrestore(&t->task_state_lock, flags);
+	pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
+	mb();/* in order to force CPU ordering */
+	spin_unlock_irq(&pm8001_ha->lock);
+	t->task_done(t);
+	spin_lock_irq(&pm8001_ha->lock);
+}
+
 /*See the comments for mpi_ssp_completion */
 static void
 mpi_sata_completion(struct pm8001_hba_info *pm8001_ha, void *piomb)
@@ -4202,7 +4353,6 @@ mpi_sata_completion(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	struct ata_task_resp *resp ;
 	u32 *sata_resp;
 	struct pm8001_device *pm8001_dev;
-	unsigned long flags;
 
 	psataPayload = (struct sata_completion_resp *)(piomb + 4);
 	status = le32_to_cpu(psataPayload->status);
@@ -4219,8 +4369,20 @@ mpi_sata_completion(struct pm8001_hba_info *pm8001_ha, void *piomb)
 			tag, ccb->ccb_tag, mpi_status_string(status)));
 		return;
 	}
-	param = le32_to_cpu(psataPayload->param);
 	t = ccb->task;
+	/*
+	 * Fast path: a DMA or NCQ command which went through clean has no
+	 * FIS to hand up, so it goes straight back.
+	 */
+	if (likely(status == IO_SUCCESS && psataPayload->param == 0
+	 && t && t->lldd_task && t->dev && t->ata_task.dma_xfer)) {
+		DEC_REQ(ccb->device, pm8001_ha);
+		t->task_status.resp = SAS_TASK_COMPLETE;
+		t->task_status.stat = SAM_STAT_GOOD;
+		mpi_sata_task_done(pm8001_ha, t, ccb, tag, status);
+		return;
+	}
+	param = le32_to_cpu(psataPayload->param);
 	ts = &t->task_status;
 	pm8001_dev = ccb->device;
 	if (status)
@@ -4508,32 +4670,7 @@ mpi_sata_completion(struct pm8001_hba_info *pm8001_ha, void *piomb)
 		ts->stat = SAS_DEV_NO_RESPONSE;
 		break;
 	}
-	spin_lock_irqsave(&t->task_state_lock, flags);
-	t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
-	t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
-	t->task_state_flags |= SAS_TASK_STATE_DONE;
-	if (unlikely((t->task_state_flags & SAS_TASK_STATE_ABORTED))) {
-		spin_unlock_irqrestore(&t->task_state_lock, flags);
-		PM8001_FAIL_DBG(pm8001_ha,
-			pm8001_printk("task 0x%p done with status %s"
-			" resp 0x%x stat 0x%x but aborted by upper layer!\n",
-			t, mpi_status_string(status), ts->resp, ts->stat));
-		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
-	} else if (t->uldd_task) {
-		spin_unlock_irqrestore(&t->task_state_lock, flags);
-		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
-		mb();/* ditto */
-		spin_unlock_irq(&pm8001_ha->lock);
-		t->task_done(t);
-		spin_lock_irq(&pm8001_ha->lock);
-	} else if (!t->uldd_task) {
-		spin_unlock_irqrestore(&t->task_state_lock, flags);
-		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
-		mb();/*ditto*/
-		spin_unlock_irq(&pm8001_ha->lock);
-		t->task_done(t);
-		spin_lock_irq(&pm8001_ha->lock);
-	}
+	mpi_sata_task_done(pm8001_ha, t, ccb, tag, status);
 }
 
 /*See the comments for mpi_ssp_completion */
@@ -5344,6 +5481,19 @@ static void pm8001_hw_event_ack_req(struct pm8001_hba_info *pm8001_ha,
 static int pm8001_chip_phy_ctl_req(struct pm8001_hba_info *pm8001_ha,
 	u32 phyId, u32 phy_op);
 
+/**
+ * pm8001_phy_up_notify - tell anybody waiting in pm8001_phys_up.
+ * @pm8001_ha: our hba card information
+ * @phy_id: the phy that has come up
+ */
+static void pm8001_phy_up_notify(struct pm8001_hba_info *pm8001_ha, u8 phy_id)
+{
+	pm8001_ha->phy_up_mask |= 1U << phy_id;
+	pm8001_ha->phy_up_jiffies = jiffies;
+	if (pm8001_ha->phy_up_completion)
+		complete(pm8001_ha->phy_up_completion);
+}
+
 /**
  * hw_event_sas_phy_up -FW tells me a SAS phy up event.
  * @pm8001_ha: our hba card information
@@ -5420,6 +5570,7 @@ hw_event_sas_phy_up(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	if (pm8001_ha->flags == PM8001F_RUN_TIME)
 		mdelay(200);/*delay a moment to wait disk to spinup*/
 	pm8001_bytes_dmaed(pm8001_ha, phy_id);
+	pm8001_phy_up_notify(pm8001_ha, phy_id);
 }
 
 /**
@@ -5464,6 +5615,7 @@ hw_event_sata_phy_up(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	pm8001_get_attached_sas_addr(phy, phy->sas_phy.attached_sas_addr);
 	spin_unlock_irqrestore(&phy->sas_phy.frame_rcvd_lock, flags);
 	pm8001_bytes_dmaed(pm8001_ha, phy_id);
+	pm8001_phy_up_notify(pm8001_ha, phy_id);
 }
 
 /**
@@ -5486,6 +5638,7 @@ hw_event_phy_down(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	struct pm8001_port *port = &pm8001_ha->port[port_id];
 	struct pm8001_phy *phy = &pm8001_ha->phy[phy_id];
 	port->port_state =  portstate;
+	pm8001_ha->phy_up_mask &= ~(1U << phy_id);
 	phy->phy_type = 0;
 	phy->identify.device_type = 0;
 	phy->phy_attached = 0;
@@ -5501,6 +5654,8 @@ hw_event_phy_down(struct pm8001_hba_info *pm8001_ha, void *piomb)
 		port->port_attached = 0;
 		pm8001_hw_event_ack_req(pm8001_ha, 0, HW_EVENT_PHY_DOWN,
 			port_id, phy_id, 0, 0);
+		pm8001_port_lost(pm8001_ha, phy->sas_phy.port);
+		pm8001_handle_event(pm8001_ha, NULL, PM8001_WORK_PORT_LOST);
 		break;
 	case PORT_IN_RESET:
 		PM8001_MSG_DBG(pm8001_ha,
@@ -5519,6 +5674,8 @@ hw_event_phy_down(struct pm8001_hba_info *pm8001_ha, void *piomb)
 		port->port_attached = 0;
 		pm8001_hw_event_ack_req(pm8001_ha, 0, HW_EVENT_PHY_DOWN,
 			port_id, phy_id, 0, 0);
+		pm8001_port_lost(pm8001_ha, phy->sas_phy.port);
+		pm8001_handle_event(pm8001_ha, NULL, PM8001_WORK_PORT_LOST);
 		break;
 	default:
 		port->port_attached = 0;
@@ -5554,11 +5711,20 @@ static int mpi_reg_resp(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	ccb = get_ccb_array(pm8001_ha, htag);
 	BUG_ON(ccb->ccb_tag != htag);
 	pm8001_dev = ccb->device;
-	DEC_REQ(pm8001_dev, pm8001_ha);
 	status = le32_to_cpu(registerRespPayload->status);
 	device_id = le32_to_cpu(registerRespPayload->device_id);
 	PM8001_MSG_DBG(pm8001_ha,
 		pm8001_printk(" register device is status = %d\n", status));
+	if (!pm8001_dev) {
+		/* pm8001_reg_detach gave up on it, the slot may be reused */
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("late register response, status = %d"
+			", device_id = %d\n", status, device_id));
+		if (status == DEVREG_SUCCESS)
+			PM8001_CHIP_DISP->dereg_dev_req(pm8001_ha, device_id);
+		goto out;
+	}
+	DEC_REQ(pm8001_dev, pm8001_ha);
 	switch (status) {
 	case DEVREG_SUCCESS:
 		PM8001_MSG_DBG(pm8001_ha, pm8001_printk("DEVREG_SUCCESS\n"));
@@ -5597,7 +5763,16 @@ static int mpi_reg_resp(struct pm8001_hba_info *pm8001_ha, void *piomb)
 		 pm8001_printk("DEVREG_FAILURE_DEVICE_TYPE_NOT_UNSORPORTED\n"));
 		break;
 	}
-	complete(pm8001_dev->dcompletion);
+	PM8001_DISC_DBG(pm8001_ha,
+		pm8001_printk("registered device [%d:%x]\n",
+		pm8001_dev->device_id, pm8001_dev->dev_type));
+	pm8001_dev->reg_pending = 0;
+	complete_all(pm8001_dev->dcompletion);
+out:
+	if (pm8001_ha->reg_outstanding)
+		pm8001_ha->reg_outstanding--;
+	if (pm8001_ha->reg_drained)
+		complete(pm8001_ha->reg_drained);
 	ccb->task = NULL;
 	ccb->ccb_tag = 0xFFFFFFFF;
 	pm8001_ccb_free(pm8001_ha, htag);
@@ -5681,12 +5856,20 @@ mpi_fw_flash_update_resp(struct pm8001_hba_info *pm8001_ha, void *piomb)
 			pm8001_printk("No matched status = %d\n", status));
 		break;
 	}
-	ccb->fw_control_context->fw_control->retcode = status;
-	pci_free_consistent(pm8001_ha->pdev,
+	/* NULL once pm8001_update_flash gave up waiting for us */
+	if (ccb->fw_control_context->fw_control)
+		ccb->fw_control_context->fw_control->retcode = status;
+	else
+		pm8001_flash_late_reply(pm8001_ha);
+	if (fw_control_context.virtAddr)
+		pci_free_consistent(pm8001_ha->pdev,
 			fw_control_context.len,
 			fw_control_context.virtAddr,
 			fw_control_context.phys_addr);
-	complete(pm8001_ha->nvmd_completion);
+	PMFREE(ccb->fw_control_context, sizeof(struct fw_control_ex));
+	ccb->fw_control_context = NULL;
+	if (pm8001_ha->nvmd_completion)
+		complete(pm8001_ha->nvmd_completion);
 	ccb->task = NULL;
 	ccb->ccb_tag = 0xFFFFFFFF;
 	pm8001_ccb_free(pm8001_ha, tag);
@@ -5822,10 +6005,11 @@ static int mpi_hw_event(struct pm8001_hba_info *pm8001_ha, void* piomb)
 		PM8001_EVT_DBG(pm8001_ha,
 			pm8001_printk("HW_EVENT_PHY_START_STATUS"
 			" status = %x\n", status));
-		if (status == 0) {
+		if (status == 0)
 			phy->phy_state = 1;
-			if (pm8001_ha->flags == PM8001F_RUN_TIME)
-				complete(phy->enable_completion);
+		if (phy->enable_completion) {
+			complete(phy->enable_completion);
+			phy->enable_completion = NULL;
 		}
 		ccb->task = NULL;
 		ccb->ccb_tag = 0xFFFFFFFF;
@@ -6188,14 +6372,13 @@ static void process_one_iomb(struct pm8001_hba_info *pm8001_ha, void *piomb)
 	}
 }
 
-static int process_oq(struct pm8001_hba_info *pm8001_ha)
+static int process_one_oq(struct pm8001_hba_info *pm8001_ha,
+	struct outbound_queue_table *circularQ)
 {
-	struct outbound_queue_table *circularQ;
 	void *pMsg1 = NULL;
 	u8 uninitialized_var(bc);
 	u32 ret = MPI_IO_STATUS_FAIL;
 
-	circularQ = &pm8001_ha->outbnd_q_tbl[0];
 	do {
 		ret = mpi_msg_consume(pm8001_ha, circularQ, &pMsg1, &bc);
 		if (MPI_IO_STATUS_SUCCESS == ret) {
@@ -6217,6 +6400,22 @@ static int process_oq(struct pm8001_hba_info *pm8001_ha)
 	return ret;
 }
 
+static int process_oq(struct pm8001_hba_info *pm8001_ha)
+{
+	u32 ret = MPI_IO_STATUS_FAIL;
+	int i;
+
+	/*
+	 * Drain the normal queue first: the firmware posts an aborted
+	 * command's completion there before the abort or TMF response on
+	 * the high priority queue, and once that response is handled
+	 * libsas may free the task the completion still refers to.
+	 */
+	for (i = 0; i < PM8001_MAX_OUTB_NUM; i++)
+		ret = process_one_oq(pm8001_ha, &pm8001_ha->outbnd_q_tbl[i]);
+	return ret;
+}
+
 /* PCI_DMA_... to our direction translation. */
 static const u8 data_dir_flags[] = {
 	[PCI_DMA_BIDIRECTIONAL] = DATA_DIR_BYRECIPIENT,/* UNSPECIFIED */
@@ -6239,6 +6438,119 @@ pm8001_chip_make_sg(struct scatterlist *scatter, int nr, void *prd)
 	}
 }
 
+/**
+ * pm8001_chip_merge_sg - build the PRD table from a mapped scatterlist,
+ * folding DMA-contiguous entries into one PRD.
+ * @pm8001_ha: our hba card information.
+ * @ccb: the ccb whose PRD table is filled.
+ * @scatter: the mapped scatterlist.
+ * @nr: the number of mapped entries.
+ *
+ * Returns the number of data PRDs written, or -SAS_QUEUE_FULL when no
+ * chained table is to be had, so the midlayer retries later. A PRD is not
+ * allowed to cross a 4GB boundary, so entries on either side of one are
+ * kept apart. When a table fills up its last PRD moves to a new table
+ * from prd_pool and is replaced by an extension PRD pointing there.
+ */
+static int
+pm8001_chip_merge_sg(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb, struct scatterlist *scatter, int nr)
+{
+	struct pm8001_prd *prd = ccb->buf_prd, *next;
+	int cap = PM8001_MAX_DMA_SG;
+	int i, k = 0, n = 0;
+	struct scatterlist *sg;
+	dma_addr_t next_dma;
+	u64 addr, start = 0, end = 0;
+	u32 len, prd_len = 0;
+
+	for_each_sg(scatter, sg, nr, i) {
+		addr = sg_dma_address(sg);
+		len = sg_dma_len(sg);
+		if (n && addr == end && prd_len + len > prd_len &&
+			upper_32_bits(start) == upper_32_bits(addr + len - 1)) {
+			prd_len += len;
+			prd[k - 1].im_len.len = cpu_to_le32(prd_len);
+			end = addr + len;
+			continue;
+		}
+		if (k == cap) {
+			if (unlikely(ccb->n_prd_chain == PM8001_MAX_PRD_CHAIN))
+				return -SAS_QUEUE_FULL;
+			next = dma_pool_alloc(pm8001_ha->prd_pool, GFP_ATOMIC,
+				&next_dma);
+			if (unlikely(!next))
+				return -SAS_QUEUE_FULL;
+			ccb->prd_chain[ccb->n_prd_chain] = next;
+			ccb->prd_chain_dma[ccb->n_prd_chain] = next_dma;
+			ccb->n_prd_chain++;
+			next[0] = prd[cap - 1];
+			prd[cap - 1].addr = cpu_to_le64(next_dma);
+			prd[cap - 1].im_len.len = cpu_to_le32(
+				PM8001_PRD_CHAIN_SG * sizeof(struct pm8001_prd));
+			prd[cap - 1].im_len.e = cpu_to_le32(1<<31);
+			prd = next;
+			cap = PM8001_PRD_CHAIN_SG;
+			k = 1;
+		}
+		prd[k].addr = cpu_to_le64(addr);
+		prd[k].im_len.len = cpu_to_le32(len);
+		prd[k].im_len.e = 0;
+		k++;
+		n++;
+		start = addr;
+		prd_len = len;
+		end = addr + len;
+	}
+	return n;
+}
+
+/**
+ * pm8001_chip_fill_sgl - fill in the SGL of an IO start command.
+ * @pm8001_ha: our hba card information.
+ * @ccb: the ccb the command is built in.
+ * @sgl: the addr_low, addr_high, len and esgl dwords of the command.
+ *
+ * The IO start commands have room for one SGL entry. When the mapped
+ * buffer folds down to a single contiguous segment it goes there, else
+ * the command points at the PRD table in the ccb.
+ */
+static int
+pm8001_chip_fill_sgl(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb, __le32 *sgl)
+{
+	struct sas_task *task = ccb->task;
+	u64 phys_addr;
+	int n = 0;
+
+	if (task->num_scatter) {
+		n = pm8001_chip_merge_sg(pm8001_ha, ccb, task->scatter,
+			ccb->n_elem);
+		if (unlikely(n < 0)) {
+			PM8001_IO_DBG(pm8001_ha,
+				pm8001_printk("no PRD table for %d entries\n",
+				ccb->n_elem));
+			return n;
+		}
+	}
+	if (n > 1) {
+		phys_addr = ccb->ccb_dma_handle +
+			offsetof(struct pm8001_ccb_info, buf_prd[0]);
+		sgl[0] = cpu_to_le32(lower_32_bits(phys_addr));
+		sgl[1] = cpu_to_le32(upper_32_bits(phys_addr));
+		sgl[2] = 0;
+		sgl[3] = cpu_to_le32(1<<31);
+	} else {
+		/* single segment or no data: inline, no SGL fetch */
+		phys_addr = n ? le64_to_cpu(ccb->buf_prd[0].addr) : 0;
+		sgl[0] = cpu_to_le32(lower_32_bits(phys_addr));
+		sgl[1] = cpu_to_le32(upper_32_bits(phys_addr));
+		sgl[2] = cpu_to_le32(task->total_xfer_len);
+		sgl[3] = 0;
+	}
+	return 0;
+}
+
 static void build_smp_cmd(u32 deviceID, __le32 hTag, struct smp_req *psmp_cmd)
 {
 	psmp_cmd->tag = hTag;
@@ -6290,7 +6602,7 @@ static int pm8001_chip_smp_req(struct pm8001_hba_info *pm8001_ha,
 	}
 
 	opc = OPC_INB_SMP_REQUEST;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	smp_cmd->tag = cpu_to_le32(ccb->ccb_tag);
 	smp_cmd->long_smp_req.long_req_addr =
 		cpu_to_le64((u64)sg_dma_address(&task->smp_task.smp_req));
@@ -6318,6 +6630,109 @@ err_out:
 	return rc;
 }
 
+/**
+ * pm8001_chip_edc_fill - fill in the EDC controls for a protected command.
+ * @task: the task, its scsi command carries the protection operation.
+ * @edc: the EDC controls of the IOMB.
+ *
+ * only DIF is offered to the midlayer, so the host memory never holds PI
+ * and the FW generates it on writes and checks and strips it on reads.
+ */
+static int pm8001_chip_edc_fill(struct sas_task *task, struct edc_info *edc)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 27)
+	struct scsi_cmnd *cmd = task->ssp_task.cmd;
+	u32 block_size = cmd->device->sector_size;
+	u32 flags = EDC_CHK_GUARD;
+	u64 lba;
+
+	switch (scsi_get_prot_op(cmd)) {
+	case SCSI_PROT_WRITE_INSERT:
+		flags |= EDC_OP_INSERT;
+		break;
+	case SCSI_PROT_READ_STRIP:
+		flags |= EDC_OP_VERIFY_STRIP;
+		break;
+	default:
+		/* the DIX operations need a protection SGL */
+		return -EINVAL;
+	}
+	/* type 3 leaves the reference tag to the application */
+	if (scsi_get_prot_type(cmd) != SCSI_PROT_DIF_TYPE3)
+		flags |= EDC_CHK_REF_TAG | EDC_INC_REF_TAG;
+	flags |= block_size << 16;
+	lba = scsi_get_lba(cmd) >> (ilog2(block_size) - 9);
+	edc->flags = cpu_to_le32(flags);
+	edc->init_ref_tag = cpu_to_le32(lower_32_bits(lba));
+	edc->app_tag = 0;
+	return 0;
+#else
+	return -EINVAL;
+#endif
+}
+
+/**
+ * pm8001_chip_ssp_ext_io_req - send a SSP task with a long CDB to FW
+ * @pm8001_ha: our hba card information.
+ * @ccb: the ccb information this request used.
+ *
+ * the extended IU does not fit one queue element, so this goes out as a
+ * two element SSPINIEXTIOSTART, or SSPINIEXTEDCIOSTART when protected;
+ * otherwise as pm8001_chip_ssp_io_req.
+ */
+static int pm8001_chip_ssp_ext_io_req(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb)
+{
+	struct sas_task *task = ccb->task;
+	struct domain_device *dev = task->dev;
+	struct pm8001_device *pm8001_dev = dev->lldd_dev;
+	struct ssp_ini_ext_io_start_req *ssp_cmd =
+		(struct ssp_ini_ext_io_start_req *) ccb->cmd;
+	struct scsi_cmnd *cmd = task->ssp_task.cmd;
+	u32 tag = ccb->ccb_tag;
+	int ret;
+	struct inbound_queue_table *circularQ;
+	u32 opc = OPC_INB_SSPINIEXTIOSTART;
+	if (unlikely(!pm8001_dev))
+		return -EINVAL;
+	if (unlikely(cmd->cmd_len > PM8001_MAX_CDB_LEN))
+		return -EINVAL;
+	memset(ssp_cmd, 0, sizeof(*ssp_cmd));
+	if (scsi_get_prot_op(cmd) != SCSI_PROT_NORMAL) {
+		if (pm8001_chip_edc_fill(task, &ssp_cmd->edc))
+			return -EINVAL;
+		opc = OPC_INB_SSPINIEXTEDCIOSTART;
+	}
+	memcpy(ssp_cmd->ssp_iu.lun, task->ssp_task.LUN, 8);
+	ssp_cmd->dir_m_tlr =
+		cpu_to_le32(data_dir_flags[task->data_dir] << 8 | 0x0);/*0 for
+	SAS 1.1 compatible TLR*/
+	ssp_cmd->data_len = cpu_to_le32(task->total_xfer_len);
+	ssp_cmd->device_id = cpu_to_le32(pm8001_dev->device_id);
+	ssp_cmd->tag = cpu_to_le32(tag);
+	if (task->ssp_task.enable_first_burst)
+		ssp_cmd->ssp_iu.efb_prio_attr |= 0x80;
+	ssp_cmd->ssp_iu.efb_prio_attr |= (task->ssp_task.task_prio << 3);
+	ssp_cmd->ssp_iu.efb_prio_attr |= (task->ssp_task.task_attr & 7);
+	/* additional CDB length is in dwords, the tail is zero padded */
+	ssp_cmd->ssp_iu.additional_cdb_len =
+		DIV_ROUND_UP(cmd->cmd_len - 16, 4) << 2;
+	memcpy(ssp_cmd->ssp_iu.cdb, cmd->cmnd, 16);
+	memcpy(ssp_cmd->add_cdb, cmd->cmnd + 16, cmd->cmd_len - 16);
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
+
+	/* fill in PRD (scatter/gather) table, if any */
+	ret = pm8001_chip_fill_sgl(pm8001_ha, ccb, &ssp_cmd->addr_low);
+	if (ret)
+		return ret;
+	ret = mpi_build_iomb(pm8001_ha, tag, circularQ, opc, ssp_cmd, 128);
+	if (ret == 0) {
+		ccb->device = pm8001_dev;
+		INC_REQ(pm8001_dev, pm8001_ha);
+	}
+	return ret;
+}
+
 /**
  * pm8001_chip_ssp_io_req - send a SSP task to FW
  * @pm8001_ha: our hba card information.
@@ -6332,12 +6747,25 @@ static int pm8001_chip_ssp_io_req(struct pm8001_hba_info *pm8001_ha,
 	struct ssp_ini_io_start_req *ssp_cmd = (struct ssp_ini_io_start_req *) ccb->cmd;
 	u32 tag = ccb->ccb_tag;
 	int ret;
-	u64 phys_addr;
 	struct inbound_queue_table *circularQ;
 	u32 opc = OPC_INB_SSPINIIOSTART;
+	u16 size = 64;
 	if (unlikely(!pm8001_dev))
 		return -EINVAL;
-	memset(ssp_cmd, 0, sizeof(*ssp_cmd));
+	if (task->ssp_task.cmd->cmd_len > 16)
+		return pm8001_chip_ssp_ext_io_req(pm8001_ha, ccb);
+	if (scsi_get_prot_op(task->ssp_task.cmd) != SCSI_PROT_NORMAL) {
+		struct ssp_ini_edc_io_start_req *edc_cmd =
+			(struct ssp_ini_edc_io_start_req *) ccb->cmd;
+
+		/* same layout up to the SGL, the EDC controls follow it */
+		memset(edc_cmd, 0, sizeof(*edc_cmd));
+		if (pm8001_chip_edc_fill(task, &edc_cmd->edc))
+			return -EINVAL;
+		opc = OPC_INB_SSPINIEDCIOSTART;
+		size = 128;
+	} else
+		memset(ssp_cmd, 0, sizeof(*ssp_cmd));
 	memcpy(ssp_cmd->ssp_iu.lun, task->ssp_task.LUN, 8);
 	ssp_cmd->dir_m_tlr =
 		cpu_to_le32(data_dir_flags[task->data_dir] << 8 | 0x0);/*0 for
@@ -6350,29 +6778,13 @@ static int pm8001_chip_ssp_io_req(struct pm8001_hba_info *pm8001_ha,
 	ssp_cmd->ssp_iu.efb_prio_attr |= (task->ssp_task.task_prio << 3);
 	ssp_cmd->ssp_iu.efb_prio_attr |= (task->ssp_task.task_attr & 7);
 	memcpy(ssp_cmd->ssp_iu.cdb, task->ssp_task.cmd->cmnd, task->ssp_task.cmd->cmd_len);
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 
 	/* fill in PRD (scatter/gather) table, if any */
-	if (task->num_scatter > 1) {
-		pm8001_chip_make_sg(task->scatter, ccb->n_elem, ccb->buf_prd);
-		phys_addr = ccb->ccb_dma_handle +
-			offsetof(struct pm8001_ccb_info, buf_prd[0]);
-		ssp_cmd->addr_low = cpu_to_le32(lower_32_bits(phys_addr));
-		ssp_cmd->addr_high = cpu_to_le32(upper_32_bits(phys_addr));
-		ssp_cmd->esgl = cpu_to_le32(1<<31);
-	} else if (task->num_scatter == 1) {
-		u64 dma_addr = sg_dma_address(task->scatter);
-		ssp_cmd->addr_low = cpu_to_le32(lower_32_bits(dma_addr));
-		ssp_cmd->addr_high = cpu_to_le32(upper_32_bits(dma_addr));
-		ssp_cmd->len = cpu_to_le32(task->total_xfer_len);
-		ssp_cmd->esgl = 0;
-	} else if (task->num_scatter == 0) {
-		ssp_cmd->addr_low = 0;
-		ssp_cmd->addr_high = 0;
-		ssp_cmd->len = cpu_to_le32(task->total_xfer_len);
-		ssp_cmd->esgl = 0;
-	}
-	ret = mpi_build_cmd(pm8001_ha, tag, circularQ, opc, ssp_cmd);
+	ret = pm8001_chip_fill_sgl(pm8001_ha, ccb, &ssp_cmd->addr_low);
+	if (ret)
+		return ret;
+	ret = mpi_build_iomb(pm8001_ha, tag, circularQ, opc, ssp_cmd, size);
 	if (ret == 0) {
 		ccb->device = pm8001_dev;
 		INC_REQ(pm8001_dev, pm8001_ha);
@@ -6390,7 +6802,6 @@ static int pm8001_chip_sata_req(struct pm8001_hba_info *pm8001_ha,
 	int ret;
 	struct sata_start_req *sata_cmd = (struct sata_start_req *) ccb->cmd;
 	u32 hdr_tag, ncg_tag = 0;
-	u64 phys_addr;
 	u32 ATAP = 0x0;
 	u32 dir;
 	struct inbound_queue_table *circularQ;
@@ -6398,7 +6809,7 @@ static int pm8001_chip_sata_req(struct pm8001_hba_info *pm8001_ha,
 	if (unlikely(!pm8001_dev))
 		return -EINVAL;
 	memset(sata_cmd, 0, sizeof(*sata_cmd));
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	if (task->data_dir == PCI_DMA_NONE) {
 		ATAP = 0x04;  /* no data*/
 		PM8001_IO_DBG(pm8001_ha, pm8001_printk("no data\n"));
@@ -6429,29 +6840,17 @@ static int pm8001_chip_sata_req(struct pm8001_hba_info *pm8001_ha,
 		sata_cmd->sata_fis.flags |= 0x80;/* C=1: update ATA cmd reg */
 	sata_cmd->sata_fis.flags &= 0xF0;/* PM_PORT field shall be 0 */
 	/* fill in PRD (scatter/gather) table, if any */
-	if (task->num_scatter > 1) {
-		pm8001_chip_make_sg(task->scatter, ccb->n_elem, ccb->buf_prd);
-		phys_addr = ccb->ccb_dma_handle +
-			offsetof(struct pm8001_ccb_info, buf_prd[0]);
-		sata_cmd->addr_low = lower_32_bits(phys_addr);
-		sata_cmd->addr_high = upper_32_bits(phys_addr);
-		sata_cmd->esgl = cpu_to_le32(1 << 31);
-	} else if (task->num_scatter == 1) {
-		u64 dma_addr = sg_dma_address(task->scatter);
-		sata_cmd->addr_low = lower_32_bits(dma_addr);
-		sata_cmd->addr_high = upper_32_bits(dma_addr);
-		sata_cmd->len = cpu_to_le32(task->total_xfer_len);
-		sata_cmd->esgl = 0;
-	} else if (task->num_scatter == 0) {
-		sata_cmd->addr_low = 0;
-		sata_cmd->addr_high = 0;
-		sata_cmd->len = cpu_to_le32(task->total_xfer_len);
-		sata_cmd->esgl = 0;
-	}
+	ret = pm8001_chip_fill_sgl(pm8001_ha, ccb, &sata_cmd->addr_low);
+	if (ret)
+		return ret;
 	ret = mpi_build_cmd(pm8001_ha, tag, circularQ, opc, sata_cmd);
 	if (ret == 0) {
 		ccb->device = pm8001_dev;
 		INC_REQ(pm8001_dev, pm8001_ha);
+		if (ATAP == 0x07)
+			pm8001_ncq_tag_get(pm8001_ha, ccb, ncg_tag);
+		else
+			pm8001_dev->non_ncq_cmds++;
 	}
 	return ret;
 }
@@ -6471,7 +6870,7 @@ pm8001_chip_phy_start_req(struct pm8001_hba_info *pm8001_ha, u8 phy_id)
 	int ret;
 	u32 tag;
 	u32 opcode = OPC_INB_PHYSTART;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 
 	if (pm8001_tag_alloc(pm8001_ha, &tag))
 		return -ENOMEM;
@@ -6519,7 +6918,7 @@ static int pm8001_chip_phy_stop_req(struct pm8001_hba_info *pm8001_ha,
 	int ret;
 	u32 tag;
 	u32 opcode = OPC_INB_PHYSTOP;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 
 	if (pm8001_tag_alloc(pm8001_ha, &tag))
 		return -ENOMEM;
@@ -6555,7 +6954,7 @@ static int pm8001_chip_reg_dev_req(struct pm8001_hba_info *pm8001_ha,
 	u16 ITNT = 2000;
 	struct domain_device *dev = pm8001_dev->sas_device;
 	struct domain_device *parent_dev = dev->parent;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_HIGH];
 
 	rc = pm8001_tag_alloc(pm8001_ha, &tag);
 	if (rc)
@@ -6596,6 +6995,7 @@ static int pm8001_chip_reg_dev_req(struct pm8001_hba_info *pm8001_ha,
 	if (rc == 0) {
 		ccb->device = pm8001_dev;
 		INC_REQ(pm8001_dev, pm8001_ha);
+		pm8001_ha->reg_outstanding++;
 	} else {
 		pm8001_tag_free(pm8001_ha, tag);
 	}
@@ -6615,8 +7015,9 @@ static int pm8001_chip_dereg_dev_req(struct pm8001_hba_info *pm8001_ha,
 	struct pm8001_ccb_info *ccb;
 	u32 tag;
 
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
-	ret = pm8001_tag_alloc(pm8001_ha, &tag);
+	/* Behind the device's I/O, which must not be fetched after it */
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
+	ret = pm8001_tag_alloc_internal(pm8001_ha, &tag);
 	if (ret)
 		return ret;
 	ccb = get_ccb_array(pm8001_ha, tag);
@@ -6652,8 +7053,8 @@ static int pm8001_chip_phy_ctl_req(struct pm8001_hba_info *pm8001_ha,
 	struct pm8001_ccb_info *ccb;
 	u32 tag;
 
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
-	ret = pm8001_tag_alloc(pm8001_ha, &tag);
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_HIGH];
+	ret = pm8001_tag_alloc_internal(pm8001_ha, &tag);
 	if (ret)
 		return ret;
 	ccb = get_ccb_array(pm8001_ha, tag);
@@ -6709,7 +7110,14 @@ static int send_task_abort(struct pm8001_hba_info *pm8001_ha, u32 opc,
 	struct inbound_queue_table *circularQ;
 	int ret;
 	BUG_ON(ccb->ccb_tag != cmd_tag);
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	/*
+	 * The high priority queue is served first, so an ABORT_ALL there
+	 * could overtake I/O for the device still waiting in the normal
+	 * ring; it goes behind that I/O instead.
+	 */
+	circularQ = &pm8001_ha->inbnd_q_tbl[
+		(ABORT_ALL == (flag & ABORT_MASK)) ?
+			PM8001_IQ_NORMAL : PM8001_IQ_HIGH];
 	memset(task_abort, 0, sizeof(*task_abort));
 	if (ABORT_SINGLE == (flag & ABORT_MASK)) {
 		task_abort->abort_all = 0;
@@ -6780,7 +7188,7 @@ static int pm8001_chip_ssp_tm_req(struct pm8001_hba_info *pm8001_ha,
 	sspTMCmd->tmf = cpu_to_le32(tmf->tmf);
 	memcpy(sspTMCmd->lun, task->ssp_task.LUN, 8);
 	sspTMCmd->tag = cpu_to_le32(ccb->ccb_tag);
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_HIGH];
 	ret = mpi_build_cmd(pm8001_ha, ccb->ccb_tag, circularQ, opc, sspTMCmd);
 	if (ret == 0) {
 		/* the caller will have pointed ccb->device at us */
@@ -6808,7 +7216,7 @@ static int pm8001_chip_get_nvmd_req(struct pm8001_hba_info *pm8001_ha,
 		return -ENOMEM;
 	fw_control_context->usrAddr = (u8 *)&ioctl_payload->func_specific[0];
 	fw_control_context->len = ioctl_payload->length;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	rc = pm8001_tag_alloc(pm8001_ha, &tag);
 	if (rc) {
 		PMFREE(fw_control_context, sizeof(struct fw_control_ex));
@@ -6892,7 +7300,7 @@ static int pm8001_chip_set_nvmd_req(struct pm8001_hba_info *pm8001_ha,
 	fw_control_context = PMALLOC(sizeof(struct fw_control_ex), GFP_KERNEL);
 	if (!fw_control_context)
 		return -ENOMEM;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	memcpy(pm8001_ha->memoryMap.region[NVMD].virt_ptr,
 		ioctl_payload->func_specific,
 		ioctl_payload->length);
@@ -6980,7 +7388,7 @@ pm8001_chip_fw_flash_update_build(struct pm8001_hba_info *pm8001_ha,
 	ccb = get_ccb_array(pm8001_ha, tag);
 	payload = (struct fw_flash_Update_req *) ccb->cmd;
 	memset(payload, 0, sizeof(*payload));
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	info = fw_flash_updata_info;
 	payload->tag = cpu_to_le32(tag);
 	payload->cur_image_len = cpu_to_le32(info->cur_image_len);
@@ -7006,18 +7414,21 @@ pm8001_chip_fw_flash_update_req(struct pm8001_hba_info *pm8001_ha,
 	u32 tag;
 	struct pm8001_ccb_info *ccb;
 	void *buffer = NULL;
-	dma_addr_t phys_addr;
+	dma_addr_t phys_addr = 0;
 	u32 phys_addr_hi;
 	u32 phys_addr_lo;
-	void *rb;
-	size_t alen;
+	void *rb = NULL;
+	size_t alen = 0;
 	struct pm8001_ioctl_payload *ioctl_payload = payload;
 
 	fw_control_context = PMALLOC(sizeof(struct fw_control_ex), GFP_KERNEL);
 	if (!fw_control_context)
 		return -ENOMEM;
 	fw_control = (struct fw_control_info *)&ioctl_payload->func_specific[0];
-	if (fw_control->len != 0) {
+	if (ioctl_payload->func_dma) {
+		/* the caller mapped the image, point straight into it */
+		phys_addr = ioctl_payload->func_dma;
+	} else if (fw_control->len != 0) {
 		if (pm8001_mem_alloc(pm8001_ha->pdev,
 			(void **)&buffer,
 			&phys_addr,
@@ -7029,8 +7440,8 @@ pm8001_chip_fw_flash_update_req(struct pm8001_hba_info *pm8001_ha,
 				PMFREE(fw_control_context, sizeof(struct fw_control_ex));
 				return -ENOMEM;
 		}
+		memcpy(buffer, fw_control->buffer, fw_control->len);
 	}
-	memcpy(buffer, fw_control->buffer, fw_control->len);
 	flash_update_info.sgl.addr = cpu_to_le64(phys_addr);
 	flash_update_info.sgl.im_len.len = cpu_to_le32(fw_control->len);
 	flash_update_info.sgl.im_len.e = 0;
@@ -7039,10 +7450,13 @@ pm8001_chip_fw_flash_update_req(struct pm8001_hba_info *pm8001_ha,
 	flash_update_info.total_image_len = fw_control->size;
 	fw_control_context->phys_addr = phys_addr;
 	fw_control_context->fw_control = fw_control;
-	fw_control_context->virtAddr = buffer;
+	fw_control_context->virtAddr = rb;
 	fw_control_context->len = alen;
 	rc = pm8001_tag_alloc(pm8001_ha, &tag);
 	if (rc) {
+		if (rb)
+			pci_free_consistent(pm8001_ha->pdev, alen, rb,
+				phys_addr);
 		PMFREE(fw_control_context, sizeof(struct fw_control_ex));
 		return rc;
 	}
@@ -7053,6 +7467,11 @@ pm8001_chip_fw_flash_update_req(struct pm8001_hba_info *pm8001_ha,
 	rc = pm8001_chip_fw_flash_update_build(pm8001_ha, &flash_update_info,
 		tag);
 	if (rc) {
+		ccb->fw_control_context = NULL;
+		if (rb)
+			pci_free_consistent(pm8001_ha->pdev, alen, rb,
+				phys_addr);
+		PMFREE(fw_control_context, sizeof(struct fw_control_ex));
 		pm8001_tag_free(pm8001_ha, tag);
 	}
 	return rc;
@@ -7068,14 +7487,14 @@ pm8001_chip_set_dev_state_req(struct pm8001_hba_info *pm8001_ha,
 	int rc;
 	u32 tag;
 	u32 opc = OPC_INB_SET_DEVICE_STATE;
-	rc = pm8001_tag_alloc(pm8001_ha, &tag);
+	rc = pm8001_tag_alloc_internal(pm8001_ha, &tag);
 	if (rc)
 		return rc;
 	ccb = get_ccb_array(pm8001_ha, tag);
 	payload = (struct set_dev_state_req *) ccb->cmd;
 	memset(payload, 0, sizeof(*payload));
 	ccb->ccb_tag = tag;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_HIGH];
 	payload->tag = cpu_to_le32(tag);
 	payload->device_id = cpu_to_le32(pm8001_dev->device_id);
 	payload->nds = cpu_to_le32(state);
@@ -7107,7 +7526,7 @@ pm8001_chip_sas_re_initialization(struct pm8001_hba_info *pm8001_ha)
 	memset(payload, 0, sizeof(*payload));
 	ccb->device = NULL;
 	ccb->ccb_tag = tag;
-	circularQ = &pm8001_ha->inbnd_q_tbl[0];
+	circularQ = &pm8001_ha->inbnd_q_tbl[PM8001_IQ_NORMAL];
 	payload->tag = cpu_to_le32(tag);
 	payload->SSAHOLT = cpu_to_le32(0xd << 25);
 	payload->sata_hol_tmo = cpu_to_le32(80);
@@ -544,8 +544,8 @@ struct sata_start_req {
 	struct host_to_dev_fis	sata_fis;
 	u32	reserved1;
 	u32	reserved2;
-	u32	addr_low;
-	u32	addr_high;
+	__le32	addr_low;
+	__le32	addr_high;
 	__le32	len;
 	__le32	esgl;
 } __attribute__((packed, aligned(4)));
@@ -597,6 +597,72 @@ struct ssp_ini_io_start_req {
 } __attribute__((packed, aligned(4)));
 
 
+/**
+ * brief the EDC (end-to-end data check) controls which the EDC IO Start
+ * Commands carry after the SGL
+ */
+struct edc_info {
+	__le32	flags;
+	/* B2-0  : EDC operation */
+	/* B4    : check guard */
+	/* B5    : check application tag */
+	/* B6    : check reference tag */
+	/* B7    : increment reference tag per block */
+	/* B31-16: logical block size */
+	__le32	init_ref_tag;
+	__le32	app_tag;
+	/* B15-0 : application tag */
+	/* B31-16: application tag check mask */
+} __attribute__((packed, aligned(4)));
+
+#define EDC_OP_INSERT				0x01/* generate PI on write */
+#define EDC_OP_VERIFY_STRIP			0x02/* check and drop PI on read */
+#define EDC_CHK_GUARD				0x10
+#define EDC_CHK_APP_TAG				0x20
+#define EDC_CHK_REF_TAG				0x40
+#define EDC_INC_REF_TAG				0x80
+
+/**
+ * brief the data structure of SSP INI EDC IO Start Command
+ * use to describe MPI SSP INI EDC IO Start Command (128 bytes), an IO
+ * start with the EDC controls in the second element
+ */
+struct ssp_ini_edc_io_start_req {
+	__le32	tag;
+	__le32	device_id;
+	__le32	data_len;
+	__le32	dir_m_tlr;
+	struct ssp_info_unit	ssp_iu;
+	__le32	addr_low;
+	__le32	addr_high;
+	__le32	len;
+	__le32	esgl;
+	struct edc_info	edc;
+	u32	reserved[13];
+} __attribute__((packed, aligned(4)));
+
+
+/**
+ * brief the data structure of SSP INI EXT IO Start Command
+ * use to describe MPI SSP INI EXT IO Start Command (128 bytes), the CDB
+ * bytes past 16 follow the IU and the SGL moves up behind them
+ */
+struct ssp_ini_ext_io_start_req {
+	__le32	tag;
+	__le32	device_id;
+	__le32	data_len;
+	__le32	dir_m_tlr;
+	struct ssp_info_unit	ssp_iu;
+	u8	add_cdb[PM8001_MAX_CDB_LEN - 16];
+	__le32	addr_low;
+	__le32	addr_high;
+	__le32	len;
+	__le32	esgl;
+	struct edc_info	edc;/* SSPINIEXTEDCIOSTART only */
+	u32	reserved[9];
+} __attribute__((packed, aligned(4)));
+
+
 /**
  * brief the data structure of Firmware download
  * use to describe MPI FW DOWNLOAD Command (64 bytes)
@@ -847,6 +913,9 @@ struct sas_re_init_resp {
  */
 #define IO_ERROR_UNKNOWN_GENERIC			0x43
 
+/* pm8001_work handlers that are not IO completions */
+#define PM8001_WORK_PORT_LOST				0x100
+
 /* MSGU CONFIGURATION  TABLE*/
 
 #define SPC_MSGU_CFG_TABLE_UPDATE		0x01/* Inbound doorbell bit0 */
@@ -58,6 +58,12 @@ static ulong pm8001_wwn_by4;
 static ulong pm8001_wwn_by8;
 static int pm8001_scsi_ehandler = 1;
 static int pm8001_disable;
+int pm8001_dev_settle;
+static int pm8001_async_probe = 1;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 27)
+static int pm8001_prot_mask = SHOST_DIF_TYPE1_PROTECTION |
+	SHOST_DIF_TYPE2_PROTECTION | SHOST_DIF_TYPE3_PROTECTION;
+#endif
 
 LIST_HEAD(hba_list);
 
@@ -89,6 +95,11 @@ static struct scsi_host_template pm8001_sht = {
 	.target_destroy		= sas_target_destroy,
 	.ioctl			= sas_ioctl,
 	.shost_attrs		= pm8001_host_attrs,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+	.sdev_groups		= pm8001_sdev_groups,
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 19)
+	.sdev_attrs		= pm8001_sdev_attrs,
+#endif
 };
 
 /**
@@ -163,12 +174,15 @@ static void pm8001_free(struct pm8001_hba_info *pm8001_ha)
 				pm8001_ha->memoryMap.region[i].phys_addr);
 			}
 	}
+	if (pm8001_ha->prd_pool)
+		dma_pool_destroy(pm8001_ha->prd_pool);
 	PM8001_CHIP_DISP->chip_iounmap(pm8001_ha);
 	if (pm8001_ha->shost)
 		scsi_host_put(pm8001_ha->shost);
 	flush_workqueue(pm8001_wq);
+	pm8001_internal_task_free(pm8001_ha);
 	PMFREE(pm8001_ha->tags, PM8001_MAX_CCB);
-	PMFREE(pm8001_ha, sizeof(struct pm8001_hba_info));
+	pm8001_debugfs_put(pm8001_ha);
 }
 
 #ifdef PM8001_USE_TASKLET
@@ -216,6 +230,19 @@ static int pm8001_alloc(struct pm8001_hba_info *pm8001_ha)
 {
 	int i;
 	spin_lock_init(&pm8001_ha->lock);
+	mutex_init(&pm8001_ha->bar4_mutex);
+	mutex_init(&pm8001_ha->port_abort_mutex);
+	INIT_WORK(&pm8001_ha->flash_reap_work, pm8001_flash_reap_work);
+#ifdef CONFIG_SCSI_PM8001_DEBUG_FS
+	init_waitqueue_head(&pm8001_ha->eventlog_wait);
+	spin_lock_init(&pm8001_ha->eventlog_lock);
+	atomic_set(&pm8001_ha->debugfs_users, 1);
+	init_rwsem(&pm8001_ha->debugfs_sem);
+	mutex_init(&pm8001_ha->debugfs_map_mutex);
+	INIT_LIST_HEAD(&pm8001_ha->debugfs_mapped);
+	INIT_DELAYED_WORK(&pm8001_ha->eventlog_work,
+		pm8001_debugfs_eventlog_work);
+#endif
 	for (i = 0; i < pm8001_ha->chip->n_phy; i++) {
 		pm8001_phy_init(pm8001_ha, i);
 		pm8001_ha->port[i].wide_port_phymap = 0;
@@ -243,27 +270,31 @@ static int pm8001_alloc(struct pm8001_hba_info *pm8001_ha)
 	pm8001_ha->memoryMap.region[IOP].alignment = 32;
 
 	/* MPI Memory region 3 for consumer Index of inbound queues */
-	pm8001_ha->memoryMap.region[CI].num_elements = 1;
+	pm8001_ha->memoryMap.region[CI].num_elements = PM8001_MAX_INB_NUM;
 	pm8001_ha->memoryMap.region[CI].element_size = 4;
-	pm8001_ha->memoryMap.region[CI].total_len = 4;
+	pm8001_ha->memoryMap.region[CI].total_len = PM8001_MAX_INB_NUM * 4;
 	pm8001_ha->memoryMap.region[CI].alignment = 4;
 
 	/* MPI Memory region 4 for producer Index of outbound queues */
-	pm8001_ha->memoryMap.region[PI].num_elements = 1;
+	pm8001_ha->memoryMap.region[PI].num_elements = PM8001_MAX_OUTB_NUM;
 	pm8001_ha->memoryMap.region[PI].element_size = 4;
-	pm8001_ha->memoryMap.region[PI].total_len = 4;
+	pm8001_ha->memoryMap.region[PI].total_len = PM8001_MAX_OUTB_NUM * 4;
 	pm8001_ha->memoryMap.region[PI].alignment = 4;
 
-	/* MPI Memory region 5 inbound queues */
-	pm8001_ha->memoryMap.region[IB].num_elements = PM8001_MPI_QUEUE;
+	/* MPI Memory region 5 inbound queues, back to back */
+	pm8001_ha->memoryMap.region[IB].num_elements =
+		PM8001_MAX_INB_NUM * PM8001_MPI_QUEUE;
 	pm8001_ha->memoryMap.region[IB].element_size = 64;
-	pm8001_ha->memoryMap.region[IB].total_len = PM8001_MPI_QUEUE * 64;
+	pm8001_ha->memoryMap.region[IB].total_len =
+		PM8001_MAX_INB_NUM * PM8001_MPI_QUEUE * 64;
 	pm8001_ha->memoryMap.region[IB].alignment = 64;
 
-	/* MPI Memory region 6 outbound queues */
-	pm8001_ha->memoryMap.region[OB].num_elements = PM8001_MPI_QUEUE;
+	/* MPI Memory region 6 outbound queues, back to back */
+	pm8001_ha->memoryMap.region[OB].num_elements =
+		PM8001_MAX_OUTB_NUM * PM8001_MPI_QUEUE;
 	pm8001_ha->memoryMap.region[OB].element_size = 64;
-	pm8001_ha->memoryMap.region[OB].total_len = PM8001_MPI_QUEUE * 64;
+	pm8001_ha->memoryMap.region[OB].total_len =
+		PM8001_MAX_OUTB_NUM * PM8001_MPI_QUEUE * 64;
 	pm8001_ha->memoryMap.region[OB].alignment = 64;
 
 	/* Memory region write DMA*/
@@ -312,12 +343,26 @@ static int pm8001_alloc(struct pm8001_hba_info *pm8001_ha)
 		}
 	}
 
+	/* PRD tables chained behind the ccb's own for large transfers */
+	pm8001_ha->prd_pool = dma_pool_create("pm8001_prd",
+		&pm8001_ha->pdev->dev,
+		PM8001_PRD_CHAIN_SG * sizeof(struct pm8001_prd), 16, 0);
+	if (!pm8001_ha->prd_pool) {
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("PRD pool alloc failed\n"));
+		goto err_out;
+	}
+
 	pm8001_ha->devices = pm8001_ha->memoryMap.region[DEV_MEM].virt_ptr;
+	INIT_LIST_HEAD(&pm8001_ha->free_dev_list);
+	INIT_LIST_HEAD(&pm8001_ha->active_dev_list);
 	for (i = 0; i < PM8001_MAX_DEVICES; i++) {
 		pm8001_ha->devices[i].dev_type = SAS_PHY_UNUSED;
 		pm8001_ha->devices[i].id = i;
 		pm8001_ha->devices[i].device_id = PM8001_MAX_DEVICES;
 		pm8001_ha->devices[i].running_req = 0;
+		list_add_tail(&pm8001_ha->devices[i].list,
+			&pm8001_ha->free_dev_list);
 	}
 
 #if (PM8001_MAX_CCB_ARRAY == 1)
@@ -350,6 +395,11 @@ static int pm8001_alloc(struct pm8001_hba_info *pm8001_ha)
 	pm8001_ha->flags = PM8001F_INIT_TIME;
 	/* Initialize tags */
 	pm8001_tag_init(pm8001_ha);
+	if (pm8001_internal_task_init(pm8001_ha)) {
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("internal task alloc failed\n"));
+		goto err_out;
+	}
 	return 0;
 err_out:
 	return 1;
@@ -515,9 +565,15 @@ static int pm8001_prep_sas_ha_init(struct Scsi_Host * shost,
 	shost->max_lun = 8;
 	shost->max_channel = 0;
 	shost->unique_id = pm8001_id;
-	shost->max_cmd_len = 16;
+	shost->max_cmd_len = PM8001_MAX_CDB_LEN;
 	shost->can_queue = PM8001_CAN_QUEUE;
 	shost->cmd_per_lun = 32;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 27)
+	/* the FW inserts and strips PI itself, there is no DIX to offer */
+	scsi_host_set_prot(shost, pm8001_prot_mask &
+		(SHOST_DIF_TYPE1_PROTECTION | SHOST_DIF_TYPE2_PROTECTION
+		| SHOST_DIF_TYPE3_PROTECTION));
+#endif
 	return 0;
 exit_free1:
 	PMFREE(arr_port, port_nr * sizeof(void *));
@@ -745,6 +801,36 @@ intx:
 	return rc;
 }
 
+/**
+ * pm8001_free_irq - unregister what pm8001_request_irq registered
+ * @pm8001_ha: our ha struct.
+ *
+ * The chip's interrupts must be disabled already.
+ */
+static void pm8001_free_irq(struct pm8001_hba_info *pm8001_ha)
+{
+	struct sas_ha_struct *sha = SHOST_TO_SAS_HA(pm8001_ha->shost);
+#ifdef PM8001_USE_MSIX
+	int i;
+
+	for (i = 0; i < pm8001_ha->number_of_intr; i++)
+		synchronize_irq(pm8001_ha->msix_entries[i].vector);
+	for (i = 0; i < pm8001_ha->number_of_intr; i++)
+		free_irq(pm8001_ha->msix_entries[i].vector, sha);
+	pci_disable_msix(pm8001_ha->pdev);
+#else
+	free_irq(pm8001_ha->irq, sha);
+#endif
+#ifdef PM8001_USE_TASKLET
+	tasklet_kill(&pm8001_ha->tasklet);
+#endif
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 29)
+#include <linux/async.h>
+#define	PM8001_ASYNC_PROBE
+#endif
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19)
 #include <linux/kthread.h>
 static int
@@ -768,6 +854,114 @@ pm8001_scan(void *arg)
 }
 #endif
 
+/**
+ * pm8001_init_sg_limits - size the host's transfers to the firmware
+ * @pm8001_ha: our hba card information
+ *
+ * The PRD tables chain, so the scatterlist may be as long as the firmware
+ * allows in the main config table (0 there means no limit of its own).
+ * max_sectors stays at the template's PM8001_MAX_HW_SECTORS; the block
+ * layer also splits on segment count, so a short firmware max_sgl still
+ * bounds the transfer.
+ * Must run between chip_init and scsi_add_host.
+ */
+static void pm8001_init_sg_limits(struct pm8001_hba_info *pm8001_ha)
+{
+	struct Scsi_Host *shost = pm8001_ha->shost;
+	u32 max_sgl = pm8001_ha->main_cfg_tbl.max_sgl & 0x0000FFFF;
+
+	shost->sg_tablesize = PM8001_MAX_CHAIN_SG;
+	if (max_sgl && max_sgl < shost->sg_tablesize)
+		shost->sg_tablesize = max_sgl;
+	PM8001_INIT_DBG(pm8001_ha,
+		pm8001_printk("FW max_sgl %u: sg_tablesize %u max_sectors %u\n",
+		max_sgl, shost->sg_tablesize, shost->max_sectors));
+}
+
+/**
+ * pm8001_pci_bringup - boot the chip and register the host
+ * @pm8001_ha: our hba card information
+ *
+ * This is the slow part of probe: HDA or soft reset, chip_init, IRQ
+ * setup, libsas registration and the scan. On failure the chip is left
+ * quiet and the caller still owns the memory from probe.
+ */
+static int pm8001_pci_bringup(struct pm8001_hba_info *pm8001_ha)
+{
+	struct Scsi_Host *shost = pm8001_ha->shost;
+	int rc;
+
+	/* HDA SEEPROM Force HDA Mode */
+	if (PM8001_CHIP_DISP->chip_in_hda_mode(pm8001_ha)) {
+		rc = PM8001_CHIP_DISP->chip_hda_mode(pm8001_ha);
+		if (!rc)
+			return -EBUSY;
+		pm8001_ha->rst_signature = SPC_HDASOFT_RESET_SIGNATURE;
+	} else {
+		PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha,
+			SPC_SOFT_RESET_SIGNATURE);
+		pm8001_ha->rst_signature = SPC_SOFT_RESET_SIGNATURE;
+	}
+	rc = PM8001_CHIP_DISP->chip_init(pm8001_ha);
+	if (rc)
+		return rc;
+	pm8001_init_sg_limits(pm8001_ha);
+
+	rc = scsi_add_host(shost, &pm8001_ha->pdev->dev);
+	if (rc)
+		return rc;
+	rc = pm8001_request_irq(pm8001_ha);
+	if (rc)
+		goto err_out_shost;
+
+	PM8001_CHIP_DISP->interrupt_enable(pm8001_ha);
+	pm8001_init_sas_add(pm8001_ha);
+	pm8001_post_sas_ha_init(shost, pm8001_ha->chip);
+	rc = sas_register_ha(SHOST_TO_SAS_HA(shost));
+	if (rc)
+		goto err_out_irq;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19)
+	/*
+	 * The necessary scan_start code isn't called for this release.
+	 * This HBA uses a different method- not the standard scsi_scan method.
+	 */
+	kthread_run(pm8001_scan, shost, "pm8001scan%d", pm8001_ha->id);
+#else
+	scsi_scan_host(pm8001_ha->shost);
+#endif
+	pm8001_debugfs_initialize(pm8001_ha);
+	return 0;
+
+err_out_irq:
+	/* remove frees pm8001_ha without touching the IRQ, quiet it here */
+	PM8001_CHIP_DISP->interrupt_disable(pm8001_ha);
+	PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha, pm8001_ha->rst_signature);
+	pm8001_free_irq(pm8001_ha);
+err_out_shost:
+	scsi_remove_host(pm8001_ha->shost);
+	return rc;
+}
+
+#ifdef PM8001_ASYNC_PROBE
+/*
+ * Bring-up runs from the async pool so that several HBAs boot their
+ * firmware side by side. A failure here can not fail the probe any
+ * more; the HBA stays bound but idle and remove frees it.
+ */
+static void pm8001_pci_probe_async(void *data, async_cookie_t cookie)
+{
+	struct pm8001_hba_info *pm8001_ha = data;
+	int rc;
+
+	rc = pm8001_pci_bringup(pm8001_ha);
+	if (rc)
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("bring-up failed %d\n", rc));
+	pm8001_ha->probe_rc = rc;
+	complete_all(&pm8001_ha->probe_done);
+}
+#endif
+
 /**
  * pm8001_pci_probe - probe supported device
  * @pdev: pci device which kernel has been prepared for.
@@ -854,51 +1048,22 @@ static int pm8001_pci_probe(struct pci_dev *pdev,
 		shost->ehandler = NULL;		// Remove error_handler
 	list_add_tail(&pm8001_ha->list, &hba_list);
 
-	/* HDA SEEPROM Force HDA Mode */
-	if (PM8001_CHIP_DISP->chip_in_hda_mode(pm8001_ha)) {
-		rc = PM8001_CHIP_DISP->chip_hda_mode(pm8001_ha);
-		if (!rc) {
-			rc = -EBUSY;
-			goto err_out_ha_free;
-		}
-		pm8001_ha->rst_signature = SPC_HDASOFT_RESET_SIGNATURE;
-	} else {
-		PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha,
-			SPC_SOFT_RESET_SIGNATURE);
-		pm8001_ha->rst_signature = SPC_SOFT_RESET_SIGNATURE;
+	init_completion(&pm8001_ha->probe_done);
+#ifdef PM8001_ASYNC_PROBE
+	if (pm8001_async_probe) {
+		async_schedule(pm8001_pci_probe_async, pm8001_ha);
+		return 0;
 	}
-	rc = PM8001_CHIP_DISP->chip_init(pm8001_ha);
-	if (rc)
-		goto err_out_ha_free;
-
-	rc = scsi_add_host(shost, &pdev->dev);
+#endif
+	rc = pm8001_pci_bringup(pm8001_ha);
+	pm8001_ha->probe_rc = rc;
+	complete_all(&pm8001_ha->probe_done);
 	if (rc)
 		goto err_out_ha_free;
-	rc = pm8001_request_irq(pm8001_ha);
-	if (rc)
-		goto err_out_shost;
-
-	PM8001_CHIP_DISP->interrupt_enable(pm8001_ha);
-	pm8001_init_sas_add(pm8001_ha);
-	pm8001_post_sas_ha_init(shost, chip);
-	rc = sas_register_ha(SHOST_TO_SAS_HA(shost));
-	if (rc)
-		goto err_out_shost;
-#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 19)
-	/*
-	 * The necessary scan_start code isn't called for this release.
-	 * This HBA uses a different method- not the standard scsi_scan method.
-	 */
-	kthread_run(pm8001_scan, shost, "pm8001scan%d", pm8001_ha->id);
-#else
-	scsi_scan_host(pm8001_ha->shost);
-#endif
-	pm8001_debugfs_initialize(pm8001_ha);
 	return 0;
 
-err_out_shost:
-	scsi_remove_host(pm8001_ha->shost);
 err_out_ha_free:
+	list_del(&pm8001_ha->list);
 	pm8001_free(pm8001_ha);
     if ((SHOST_TO_SAS_HA(shost))->sas_phy != NULL)
        PMFREE((SHOST_TO_SAS_HA(shost))->sas_phy, chip->n_phy * sizeof(void *));
@@ -921,29 +1086,24 @@ static void pm8001_pci_remove(struct pci_dev *pdev)
 {
 	struct sas_ha_struct *sha = pci_get_drvdata(pdev);
 	struct pm8001_hba_info *pm8001_ha;
-	int i;
 	pm8001_ha = sha->lldd_ha;
-	pm8001_debugfs_terminate(pm8001_ha);
+	wait_for_completion(&pm8001_ha->probe_done);
 	pci_set_drvdata(pdev, NULL);
+	if (pm8001_ha->probe_rc) {
+		list_del(&pm8001_ha->list);
+		goto out_free;
+	}
+	pm8001_debugfs_terminate(pm8001_ha);
 	sas_unregister_ha(sha);
 	sas_remove_host(pm8001_ha->shost);
 	list_del(&pm8001_ha->list);
 	scsi_remove_host(pm8001_ha->shost);
 	PM8001_CHIP_DISP->interrupt_disable(pm8001_ha);
 	PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha, pm8001_ha->rst_signature);
-
-#ifdef PM8001_USE_MSIX
-	for (i = 0; i < pm8001_ha->number_of_intr; i++)
-		synchronize_irq(pm8001_ha->msix_entries[i].vector);
-	for (i = 0; i < pm8001_ha->number_of_intr; i++)
-		free_irq(pm8001_ha->msix_entries[i].vector, sha);
-	pci_disable_msix(pdev);
-#else
-	free_irq(pm8001_ha->irq, sha);
-#endif
-#ifdef PM8001_USE_TASKLET
-	tasklet_kill(&pm8001_ha->tasklet);
-#endif
+	pm8001_free_irq(pm8001_ha);
+	pm8001_flash_reap(pm8001_ha);
+	pm8001_debugfs_revoke(pm8001_ha);
+out_free:
 	pm8001_free(pm8001_ha);
 	PMFREE(sha->sas_phy, sha->num_phys *  sizeof(void *));
 	PMFREE(sha->sas_port, sha->num_phys * sizeof(void *));
@@ -963,9 +1123,13 @@ static int pm8001_pci_suspend(struct pci_dev *pdev, pm_message_t state)
 {
 	struct sas_ha_struct *sha = pci_get_drvdata(pdev);
 	struct pm8001_hba_info *pm8001_ha;
-	int i , pos;
+	int pos;
 	u32 device_state;
 	pm8001_ha = sha->lldd_ha;
+	wait_for_completion(&pm8001_ha->probe_done);
+	/* an HBA whose bring-up failed is idle, it must not hold up suspend */
+	if (pm8001_ha->probe_rc)
+		return 0;
 	pm8001_debugfs_terminate(pm8001_ha);
 	flush_workqueue(pm8001_wq);
 	scsi_block_requests(pm8001_ha->shost);
@@ -976,18 +1140,8 @@ static int pm8001_pci_suspend(struct pci_dev *pdev, pm_message_t state)
 	}
 	PM8001_CHIP_DISP->interrupt_disable(pm8001_ha);
 	PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha, pm8001_ha->rst_signature);
-#ifdef PM8001_USE_MSIX
-	for (i = 0; i < pm8001_ha->number_of_intr; i++)
-		synchronize_irq(pm8001_ha->msix_entries[i].vector);
-	for (i = 0; i < pm8001_ha->number_of_intr; i++)
-		free_irq(pm8001_ha->msix_entries[i].vector, sha);
-	pci_disable_msix(pdev);
-#else
-	free_irq(pm8001_ha->irq, sha);
-#endif
-#ifdef PM8001_USE_TASKLET
-	tasklet_kill(&pm8001_ha->tasklet);
-#endif
+	pm8001_free_irq(pm8001_ha);
+	pm8001_flash_reap(pm8001_ha);
 	device_state = pci_choose_state(pdev, state);
 	pm8001_printk("pdev=0x%p, slot=%s, entering "
 		      "operating state [D%d]\n", pdev,
@@ -1011,6 +1165,9 @@ static int pm8001_pci_resume(struct pci_dev *pdev)
 	int rc;
 	u32 device_state;
 	pm8001_ha = sha->lldd_ha;
+	/* suspend left an HBA whose bring-up failed alone, so does resume */
+	if (pm8001_ha->probe_rc)
+		return 0;
 	device_state = pdev->current_state;
 
 	pm8001_printk("pdev=0x%p, slot=%s, resuming from previous "
@@ -1031,7 +1188,15 @@ static int pm8001_pci_resume(struct pci_dev *pdev)
 	if (rc)
 		goto err_out_disable;
 
-	PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha, pm8001_ha->rst_signature);
+	/* an HDA booted chip needs its images again, from the cache */
+	if (pm8001_ha->rst_signature == SPC_HDASOFT_RESET_SIGNATURE) {
+		if (!PM8001_CHIP_DISP->chip_hda_mode(pm8001_ha)) {
+			rc = -EBUSY;
+			goto err_out_disable;
+		}
+	} else
+		PM8001_CHIP_DISP->chip_soft_rst(pm8001_ha,
+			pm8001_ha->rst_signature);
 	rc = PM8001_CHIP_DISP->chip_init(pm8001_ha);
 	if (rc)
 		goto err_out_disable;
@@ -1112,6 +1277,7 @@ static void __exit pm8001_exit(void)
 	pci_unregister_driver(&pm8001_pci_driver);
 	sas_release_transport(pm8001_stt);
 	destroy_workqueue(pm8001_wq);
+	pm8001_hda_fw_release();
 #if PMDEBUG > 0
 	if (pmallocation) {
 		printk(KERN_WARNING "exiting pm8001 with %lx bytes unfreed\n", (unsigned long)pmallocation);
@@ -1132,6 +1298,14 @@ module_param_named(scsi_ehandler, pm8001_scsi_ehandler, int, S_IRUGO);
 MODULE_PARM_DESC(scsi_ehandler, "Enable scsi error handler");
 module_param_named(disable, pm8001_disable, int, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(disable, "Disable Driver");
+module_param_named(dev_settle, pm8001_dev_settle, int, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(dev_settle, "ms to wait after registering an end device (0)");
+module_param_named(async_probe, pm8001_async_probe, int, S_IRUGO);
+MODULE_PARM_DESC(async_probe, "Bring up HBAs in parallel after probe (1)");
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 27)
+module_param_named(prot_mask, pm8001_prot_mask, int, S_IRUGO);
+MODULE_PARM_DESC(prot_mask, "DIF types offered, SHOST_DIF_TYPEn bits (0x7)");
+#endif
 module_init(pm8001_init);
 module_exit(pm8001_exit);
 
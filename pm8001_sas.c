@@ -90,18 +90,21 @@ static void pm8001_tag_set(struct pm8001_hba_info *pm8001_ha, u32 tag)
 }
 
 /**
-  * pm8001_tag_alloc - allocate a empty tag for task used.
+  * pm8001_tag_find - allocate a empty tag within a range of tags.
   * @pm8001_ha: our hba struct
   * @tag_out: the found empty tag .
+  * @start: first tag of the range.
+  * @end: one past the last tag of the range.
   */
-inline int pm8001_tag_alloc(struct pm8001_hba_info *pm8001_ha, u32 *tag_out)
+static inline int pm8001_tag_find(struct pm8001_hba_info *pm8001_ha,
+	u32 *tag_out, unsigned int start, unsigned int end)
 {
 	unsigned int index, tag;
 	void *bitmap = pm8001_ha->tags;
 
-	index = find_first_zero_bit(bitmap, pm8001_ha->tags_num);
+	index = find_next_zero_bit(bitmap, end, start);
 	tag = index;
-	if (tag >= pm8001_ha->tags_num)
+	if (tag >= end)
 		return -SAS_QUEUE_FULL;
 	tag = TAG_MAKE(pm8001_ha, tag);
 	pm8001_tag_set(pm8001_ha, tag);
@@ -109,6 +112,36 @@ inline int pm8001_tag_alloc(struct pm8001_hba_info *pm8001_ha, u32 *tag_out)
 	return 0;
 }
 
+/**
+  * pm8001_tag_alloc - allocate a empty tag for task used.
+  * @pm8001_ha: our hba struct
+  * @tag_out: the found empty tag .
+  *
+  * The top PM8001_INTERNAL_CCB tags are left for pm8001_tag_alloc_internal.
+  */
+inline int pm8001_tag_alloc(struct pm8001_hba_info *pm8001_ha, u32 *tag_out)
+{
+	return pm8001_tag_find(pm8001_ha, tag_out, 0,
+		pm8001_ha->tags_num - PM8001_INTERNAL_CCB);
+}
+
+/**
+  * pm8001_tag_alloc_internal - allocate a tag for error handling.
+  * @pm8001_ha: our hba struct
+  * @tag_out: the found empty tag .
+  *
+  * Aborts, TMFs and the device management they depend on draw from the
+  * reserved tags first, so a full I/O load can not starve them.
+  */
+int pm8001_tag_alloc_internal(struct pm8001_hba_info *pm8001_ha, u32 *tag_out)
+{
+	if (!pm8001_tag_find(pm8001_ha, tag_out,
+			pm8001_ha->tags_num - PM8001_INTERNAL_CCB,
+			pm8001_ha->tags_num))
+		return 0;
+	return pm8001_tag_alloc(pm8001_ha, tag_out);
+}
+
 void pm8001_tag_init(struct pm8001_hba_info *pm8001_ha)
 {
 	void *bitmap = pm8001_ha->tags;
@@ -190,7 +223,6 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 	DECLARE_COMPLETION_ONSTACK(completion);
 	unsigned long flags;
 	pm8001_ha = sas_phy->ha->lldd_ha;
-	pm8001_ha->phy[phy_id].enable_completion = &completion;
 	switch (func) {
 	case PHY_FUNC_SET_LINK_RATE:
 		rates = PMCS_FUNCDATA_VAL;
@@ -203,6 +235,7 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 				rates->maximum_linkrate;
 		}
 		if (pm8001_ha->phy[phy_id].phy_state == 0) {
+			pm8001_ha->phy[phy_id].enable_completion = &completion;
 			PM8001_CHIP_DISP->phy_start_req(pm8001_ha, phy_id);
 			wait_for_completion(&completion);
 		}
@@ -211,6 +244,7 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 		break;
 	case PHY_FUNC_HARD_RESET:
 		if (pm8001_ha->phy[phy_id].phy_state == 0) {
+			pm8001_ha->phy[phy_id].enable_completion = &completion;
 			PM8001_CHIP_DISP->phy_start_req(pm8001_ha, phy_id);
 			wait_for_completion(&completion);
 		}
@@ -219,6 +253,7 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 		break;
 	case PHY_FUNC_LINK_RESET:
 		if (pm8001_ha->phy[phy_id].phy_state == 0) {
+			pm8001_ha->phy[phy_id].enable_completion = &completion;
 			PM8001_CHIP_DISP->phy_start_req(pm8001_ha, phy_id);
 			wait_for_completion(&completion);
 		}
@@ -233,10 +268,12 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 		PM8001_CHIP_DISP->phy_stop_req(pm8001_ha, phy_id);
 		break;
 	case PHY_FUNC_GET_EVENTS:
+		mutex_lock(&pm8001_ha->bar4_mutex);
 		spin_lock_irqsave(&pm8001_ha->lock, flags);
 		if (-1 == pm8001_bar4_shift(pm8001_ha,
 					(phy_id < 4) ? 0x30000 : 0x40000)) {
 			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			mutex_unlock(&pm8001_ha->bar4_mutex);
 			return -EINVAL;
 		}
 		{
@@ -252,6 +289,7 @@ int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
 		}
 		pm8001_bar4_shift(pm8001_ha, 0);
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		mutex_unlock(&pm8001_ha->bar4_mutex);
 		return 0;
 	default:
 		rc = -EOPNOTSUPP;
@@ -272,15 +310,29 @@ void pm8001_scan_start(struct Scsi_Host *shost)
 	struct sas_ha_struct *sha = SHOST_TO_SAS_HA(shost);
 	pm8001_ha = sha->lldd_ha;
 	PM8001_CHIP_DISP->sas_re_init_req(pm8001_ha);
-	for (i = 0; i < pm8001_ha->chip->n_phy; ++i)
+	for (i = 0; i < pm8001_ha->chip->n_phy; ++i) {
+		pm8001_ha->phy[i].enable_completion = NULL;
 		PM8001_CHIP_DISP->phy_start_req(pm8001_ha, i);
+	}
 }
 
+/* phys linking at probe come up together, a quiet spell means no more */
+#define PM8001_PHY_QUIET	(HZ / 4)
 int pm8001_scan_finished(struct Scsi_Host *shost, unsigned long time)
 {
-	/* give the phy enabling interrupt event time to come in (1s
-	* is empirically about all it takes) */
-	if (time < HZ)
+	struct sas_ha_struct *sha = SHOST_TO_SAS_HA(shost);
+	struct pm8001_hba_info *pm8001_ha = sha->lldd_ha;
+	u32 all = (1U << pm8001_ha->chip->n_phy) - 1;
+	u32 up = pm8001_ha->phy_up_mask & all;
+
+	/*
+	 * give the phy enabling interrupt event time to come in (1s is
+	 * empirically about all it takes). An unconnected phy never reports,
+	 * so only the phys that linked are waited for: stop early when all
+	 * are up, or when some are and no other followed for a while.
+	 */
+	if (time < HZ && up != all && !(up && time_after(jiffies,
+		pm8001_ha->phy_up_jiffies + PM8001_PHY_QUIET)))
 		return 0;
 	/* Wait for discovery to finish */
 	scsi_flush_work(shost);
@@ -388,6 +440,35 @@ static int sas_find_local_port_id(struct domain_device *dev)
   */
 #define DEV_IS_GONE(pm8001_dev)	\
 	(!pm8001_dev || (pm8001_dev->dev_type == SAS_PHY_UNUSED) || (pm8001_dev->dying))
+#define PM8001_TASK_TIMEOUT 20
+
+/**
+  * pm8001_dev_registered - make sure the FW has given the device an ID.
+  * @pm8001_dev: the device the task is headed for.
+  * @gfp_flags: gfp_flags of the caller.
+  *
+  * registration is not waited for in pm8001_dev_found_notify, so the first
+  * task to a device may beat mpi_reg_resp. Callers that can sleep wait for
+  * the response, everybody else is asked to come back later. A device the
+  * FW gave no ID (failed or timed out registration) takes no tasks.
+  */
+static int pm8001_dev_registered(struct pm8001_device *pm8001_dev,
+	PMCS_GFP_T gfp_flags)
+{
+	if (likely(!pm8001_dev))
+		return 0;
+	if (unlikely(pm8001_dev->reg_pending)) {
+		if (!PMCS_GFP_CAN_SLEEP(gfp_flags))
+			return -SAS_QUEUE_FULL;
+		if (!wait_for_completion_timeout(&pm8001_dev->reg_completion,
+			PM8001_TASK_TIMEOUT * HZ))
+			return -ETIMEDOUT;
+	}
+	if (unlikely(pm8001_dev->device_id == PM8001_MAX_DEVICES))
+		return -ENODEV;
+	return 0;
+}
+
 static int pm8001_task_exec(struct sas_task *task,
 	gfp_t gfp_flags, int is_tmf, struct pm8001_tmf_task *tmf)
 {
@@ -410,6 +491,9 @@ static int pm8001_task_exec(struct sas_task *task,
 	}
 	pm8001_ha = pm8001_find_ha_by_dev(task->dev);
 	PM8001_IO_DBG(pm8001_ha, pm8001_printk("pm8001_task_exec device\n"));
+	rc = pm8001_dev_registered(dev->lldd_dev, gfp_flags);
+	if (rc)
+		return rc;
 	spin_lock_irqsave(&pm8001_ha->lock, flags);
 	do {
 		dev = t->dev;
@@ -440,7 +524,8 @@ static int pm8001_task_exec(struct sas_task *task,
 				continue;
 			}
 		}
-		rc = pm8001_tag_alloc(pm8001_ha, &tag);
+		rc = is_tmf ? pm8001_tag_alloc_internal(pm8001_ha, &tag) :
+			pm8001_tag_alloc(pm8001_ha, &tag);
 		if (rc) {
 			goto err_out;
 		}
@@ -495,7 +580,7 @@ static int pm8001_task_exec(struct sas_task *task,
 				pm8001_printk("rc is %x\n", rc));
 			goto err_out_tag;
 		}
-		/* TODO: select normal or high priority */
+		/* TMFs are queued at high priority by the chip layer */
 		spin_lock(&t->task_state_lock);
 		t->task_state_flags |= SAS_TASK_AT_INITIATOR;
 		spin_unlock(&t->task_state_lock);
@@ -504,6 +589,7 @@ static int pm8001_task_exec(struct sas_task *task,
 	goto out_done;
 
 err_out_tag:
+	pm8001_prd_chain_free(pm8001_ha, ccb);
 	pm8001_tag_free(pm8001_ha, tag);
 err_out:
 	PM8001_EH_DBG(pm8001_ha,
@@ -532,11 +618,63 @@ int pm8001_queue_command(struct sas_task *task,
 	return pm8001_task_exec(task, gfp_flags, 0, NULL);
 }
 
+/**
+  * pm8001_ncq_tag_get - account an NCQ tag going out to a SATA device.
+  * @pm8001_ha: our hba card information
+  * @ccb: the ccb which carries the FPDMA command
+  * @ncq_tag: the tag libata picked
+  *
+  * HA lock is held. The tag is given back when the ccb is freed.
+  */
+void pm8001_ncq_tag_get(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb, u32 ncq_tag)
+{
+	struct pm8001_device *pm8001_dev = ccb->device;
+	u32 active;
+
+	if (pm8001_dev->ncq_tags & (1U << ncq_tag))
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("dev[%x] NCQ tag %u already in use\n",
+			pm8001_dev->device_id, ncq_tag));
+	pm8001_dev->ncq_tags |= 1U << ncq_tag;
+	ccb->ncq_tag = ncq_tag;
+	ccb->ncq_active = 1;
+	active = hweight32(pm8001_dev->ncq_tags);
+	if (active > pm8001_dev->ncq_peak)
+		pm8001_dev->ncq_peak = active;
+	pm8001_dev->ncq_cmds++;
+	pm8001_dev->ncq_active_sum += active;
+}
+
 void pm8001_ccb_free(struct pm8001_hba_info *pm8001_ha, u32 ccb_idx)
 {
+	struct pm8001_ccb_info *ccb = get_ccb_array(pm8001_ha, ccb_idx);
+
+	pm8001_prd_chain_free(pm8001_ha, ccb);
+	if (ccb->ncq_active) {
+		if (ccb->device)
+			ccb->device->ncq_tags &= ~(1U << ccb->ncq_tag);
+		ccb->ncq_active = 0;
+	}
 	pm8001_tag_clear(pm8001_ha, ccb_idx);
 }
 
+/**
+ * pm8001_prd_chain_free - give back the chained PRD tables of a ccb
+ * @pm8001_ha: our hba card information
+ * @ccb: the ccb whose I/O is done or was never started
+ */
+void pm8001_prd_chain_free(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb)
+{
+	while (ccb->n_prd_chain) {
+		ccb->n_prd_chain--;
+		dma_pool_free(pm8001_ha->prd_pool,
+			ccb->prd_chain[ccb->n_prd_chain],
+			ccb->prd_chain_dma[ccb->n_prd_chain]);
+	}
+}
+
 /**
   * pm8001_ccb_task_free - free the sg for ssp and smp command, free the ccb.
   * @pm8001_ha: our hba card information
@@ -584,22 +722,24 @@ void pm8001_ccb_task_free(struct pm8001_hba_info *pm8001_ha,
  /**
   * pm8001_alloc_dev - find a empty pm8001_device
   * @pm8001_ha: our hba card information
+  *
+  * HA lock is held on entry here. The slot moves from free_dev_list to
+  * active_dev_list.
   */
 struct pm8001_device *pm8001_alloc_dev(struct pm8001_hba_info *pm8001_ha)
 {
-	u32 dev;
-	for (dev = 0; dev < PM8001_MAX_DEVICES; dev++) {
-		if (pm8001_ha->devices[dev].dev_type == SAS_PHY_UNUSED) {
-			pm8001_ha->devices[dev].id = dev;
-			return &pm8001_ha->devices[dev];
-		}
-	}
-	if (dev == PM8001_MAX_DEVICES) {
+	struct pm8001_device *pm8001_dev;
+
+	if (list_empty(&pm8001_ha->free_dev_list)) {
 		PM8001_FAIL_DBG(pm8001_ha,
 			pm8001_printk("max support %d devices, ignore ..\n",
 			PM8001_MAX_DEVICES));
+		return NULL;
 	}
-	return NULL;
+	pm8001_dev = list_first_entry(&pm8001_ha->free_dev_list,
+		struct pm8001_device, list);
+	list_move_tail(&pm8001_dev->list, &pm8001_ha->active_dev_list);
+	return pm8001_dev;
 }
 
 /*
@@ -608,10 +748,12 @@ struct pm8001_device *pm8001_alloc_dev(struct pm8001_hba_info *pm8001_ha)
 static void pm8001_free_dev(struct pm8001_hba_info *pm8001_ha, struct pm8001_device *pm8001_dev)
 {
 	u32 id = pm8001_dev->id;
+	list_del(&pm8001_dev->list);
 	memset(pm8001_dev, 0, sizeof(*pm8001_dev));
 	pm8001_dev->id = id;
 	pm8001_dev->dev_type = SAS_PHY_UNUSED;
 	pm8001_dev->device_id = PM8001_MAX_DEVICES;
+	list_add_tail(&pm8001_dev->list, &pm8001_ha->free_dev_list);
 }
 
 /**
@@ -625,6 +767,13 @@ static void pm8001_free_dev(struct pm8001_hba_info *pm8001_ha, struct pm8001_dev
   * now on, we communicate with HBA FW with the device ID which HBA assigned
   * rather than sas address. it is the necessary step for our HBA but it is
   * the optional for other HBA driver.
+  *
+  * the registration of SAS end devices is not waited for here, so libsas
+  * can go on to find the next device while the FW works through the
+  * OPC_INB_REG_DEV backlog; mpi_reg_resp completes it and
+  * pm8001_dev_registered holds off the first task until it has. SATA
+  * devices are waited for: libsas hands their first IDENTIFY over with
+  * GFP_ATOMIC, and a refused one costs libata an EH round and a reset.
   */
 static int pm8001_dev_found_notify(struct domain_device *dev)
 {
@@ -633,11 +782,9 @@ static int pm8001_dev_found_notify(struct domain_device *dev)
 	struct pm8001_hba_info *pm8001_ha = NULL;
 	struct domain_device *parent_dev = dev->parent;
 	struct pm8001_device *pm8001_device;
-	DECLARE_COMPLETION_ONSTACK(completion);
 	u32 flag = 0;
 	pm8001_ha = pm8001_find_ha_by_dev(dev);
 	spin_lock_irqsave(&pm8001_ha->lock, flags);
-
 	pm8001_device = pm8001_alloc_dev(pm8001_ha);
 	if (!pm8001_device) {
 		res = -1;
@@ -646,7 +793,8 @@ static int pm8001_dev_found_notify(struct domain_device *dev)
 	pm8001_device->sas_device = dev;
 	dev->lldd_dev = pm8001_device;
 	pm8001_device->dev_type = dev->dev_type;
-	pm8001_device->dcompletion = &completion;
+	init_completion(&pm8001_device->reg_completion);
+	pm8001_device->dcompletion = &pm8001_device->reg_completion;
 	if (parent_dev && DEV_IS_EXPANDER(parent_dev->dev_type)) {
 		int phy_id;
 		struct ex_phy *phy;
@@ -674,19 +822,30 @@ static int pm8001_dev_found_notify(struct domain_device *dev)
 				flag = 1; /* directly sata*/
 		}
 	} /*register this device to HBA*/
-	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-	msleep(1);
-	spin_lock_irqsave(&pm8001_ha->lock, flags);
-	PM8001_CHIP_DISP->reg_dev_req(pm8001_ha, pm8001_device, flag);
-	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-	wait_for_completion(&completion);
-	PM8001_DISC_DBG(pm8001_ha, pm8001_printk("Found device [%d:%x]\n", pm8001_device->device_id, pm8001_device->dev_type));
-	if (dev->dev_type == SAS_END_DEVICE)
-		msleep(50);
+	pm8001_device->reg_pending = 1;
+	res = PM8001_CHIP_DISP->reg_dev_req(pm8001_ha, pm8001_device, flag);
+	if (res) {
+		pm8001_device->reg_pending = 0;
+		goto found_out;
+	}
 	pm8001_ha->flags = PM8001F_RUN_TIME;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	PM8001_DISC_DBG(pm8001_ha, pm8001_printk("Found device [%d:%x]\n", pm8001_device->id, pm8001_device->dev_type));
+	if (dev_is_sata(dev)) {
+		if (!wait_for_completion_timeout(&pm8001_device->reg_completion,
+			PM8001_TASK_TIMEOUT * HZ))
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("device [%d] not registered in"
+				" %ds\n", pm8001_device->id,
+				PM8001_TASK_TIMEOUT));
+	} else if (pm8001_dev_settle && dev->dev_type == SAS_END_DEVICE) {
+		wait_for_completion(&pm8001_device->reg_completion);
+		msleep(pm8001_dev_settle);
+	}
 	return 0;
 found_out:
 	if (pm8001_device) {
+		dev->lldd_dev = NULL;
 		pm8001_free_dev(pm8001_ha, pm8001_device);
 	}
 	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
@@ -699,18 +858,109 @@ int pm8001_dev_found(struct domain_device *dev)
 }
 
 /**
-  * pm8001_alloc_task - allocate a task structure for TMF
+  * pm8001_internal_task_init - preallocate the tasks for TMF and abort
+  * @pm8001_ha: our hba struct
   */
-static struct sas_task *pm8001_alloc_task(void)
+int pm8001_internal_task_init(struct pm8001_hba_info *pm8001_ha)
 {
-	return sas_alloc_slow_task(GFP_KERNEL); // TODO ENOMEM CHECK
+	int i;
+
+	for (i = 0; i < PM8001_INTERNAL_TASKS; i++) {
+		pm8001_ha->internal_task[i] = sas_alloc_slow_task(GFP_KERNEL);
+		if (!pm8001_ha->internal_task[i])
+			return -ENOMEM;
+	}
+	pm8001_ha->internal_task_busy = 0;
+	return 0;
 }
 
-static void pm8001_free_task(struct sas_task *task)
+/**
+  * pm8001_internal_task_free - release the preallocated tasks
+  * @pm8001_ha: our hba struct
+  */
+void pm8001_internal_task_free(struct pm8001_hba_info *pm8001_ha)
+{
+	int i;
+
+	for (i = 0; i < PM8001_INTERNAL_TASKS; i++) {
+		if (pm8001_ha->internal_task[i])
+			sas_free_task(pm8001_ha->internal_task[i]);
+		pm8001_ha->internal_task[i] = NULL;
+	}
+}
+
+/**
+  * pm8001_internal_task_reset - return a task to its just allocated state
+  * @task: the task, which is reused for every retry.
+  */
+static void pm8001_internal_task_reset(struct sas_task *task)
+{
+	struct sas_task_slow *slow = task->slow_task;
+
+	memset(task, 0, sizeof(*task));
+	INIT_LIST_HEAD(&task->list);
+	spin_lock_init(&task->task_state_lock);
+	task->task_state_flags = SAS_TASK_STATE_PENDING;
+	task->slow_task = slow;
+	memset(slow, 0, sizeof(*slow));
+	slow->task = task;
+	init_timer(&slow->timer);
+	init_completion(&slow->completion);
+}
+
+/**
+  * pm8001_internal_task_get - take a task structure for TMF or abort
+  * @pm8001_ha: our hba struct
+  *
+  * Takes one of the preallocated tasks; only when more error handlers run
+  * at once than were planned for does it fall back to allocating.
+  */
+static struct sas_task *
+pm8001_internal_task_get(struct pm8001_hba_info *pm8001_ha)
+{
+	unsigned long flags;
+	struct sas_task *task = NULL;
+	int i;
+
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	i = find_first_zero_bit(&pm8001_ha->internal_task_busy,
+		PM8001_INTERNAL_TASKS);
+	if (i < PM8001_INTERNAL_TASKS) {
+		set_bit(i, &pm8001_ha->internal_task_busy);
+		task = pm8001_ha->internal_task[i];
+	}
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	if (!task)
+		return sas_alloc_slow_task(GFP_KERNEL);
+	pm8001_internal_task_reset(task);
+	return task;
+}
+
+/**
+  * pm8001_internal_task_put - return a task taken with
+  * pm8001_internal_task_get
+  * @pm8001_ha: our hba struct
+  * @task: the task, its timer must no longer be pending.
+  */
+static void pm8001_internal_task_put(struct pm8001_hba_info *pm8001_ha,
+	struct sas_task *task)
 {
-	if (task) {
-		sas_free_task(task);
+	unsigned long flags;
+	int i;
+
+	if (!task)
+		return;
+	for (i = 0; i < PM8001_INTERNAL_TASKS; i++) {
+		if (pm8001_ha->internal_task[i] != task)
+			continue;
+		/* pm8001_tmf_timedout may still be on its way out */
+		del_timer_sync(&task->slow_task->timer);
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		clear_bit(i, &pm8001_ha->internal_task_busy);
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		return;
 	}
+	sas_free_task(task);
 }
 
 static void pm8001_task_done(struct sas_task *task)
@@ -733,7 +983,6 @@ static void pm8001_tmf_timedout(unsigned long data)
 	complete(&task->slow_task->completion);
 }
 
-#define PM8001_TASK_TIMEOUT 20
 /**
   * pm8001_exec_internal_tmf_task - execute some task management commands.
   * @dev: the wanted device.
@@ -754,14 +1003,17 @@ static int pm8001_exec_internal_tmf_task(struct domain_device *dev,
 	struct pm8001_ccb_info *ccb;
 	struct pm8001_hba_info *pm8001_ha = pm8001_find_ha_by_dev(dev);
 
+	task = pm8001_internal_task_get(pm8001_ha);
+	if (!task) {
+		PM8001_FAIL_DBG(pm8001_ha,
+			pm8001_printk("allocating internal task failed\n"));
+		return TMF_RESP_FUNC_FAILED;
+	}
 	for (retry = 0; retry < 3; retry++) {
 		res = TMF_RESP_FUNC_FAILED;
-		task = pm8001_alloc_task();
-		if (!task) {
-			PM8001_FAIL_DBG(pm8001_ha,
-				pm8001_printk("allocating internal task failed\n"));
-			goto ex_err;
-		}
+		/* every retry reuses the task */
+		if (retry)
+			pm8001_internal_task_reset(task);
 		task->dev = dev;
 		task->task_proto = dev->tproto;
 		memcpy(&task->ssp_task, parameter, para_len);
@@ -825,13 +1077,9 @@ static int pm8001_exec_internal_tmf_task(struct domain_device *dev,
 		PM8001_EH_DBG(pm8001_ha,
 		    pm8001_printk(" Task to dev %016llx response: 0x%x status 0x%x\n",
 			SAS_ADDR(dev->sas_addr), task->task_status.resp, task->task_status.stat));
-		pm8001_free_task(task);
-		task = NULL;
 	}
 ex_err:
-	BUG_ON(retry == 3 && task != NULL);
-	if (task != NULL)
-		pm8001_free_task(task);
+	pm8001_internal_task_put(pm8001_ha, task);
 	return res;
 }
 
@@ -846,11 +1094,13 @@ pm8001_exec_internal_task_abort(struct pm8001_hba_info *pm8001_ha,
 	struct pm8001_ccb_info *ccb;
 	struct sas_task *task = NULL;
 
+	task = pm8001_internal_task_get(pm8001_ha);
+	if (!task)
+		return -ENOMEM;
 	for (retry = 0; retry < 3; retry++) {
-		task = pm8001_alloc_task();
-		if (!task)
-			return -ENOMEM;
-
+		/* every retry reuses the task */
+		if (retry)
+			pm8001_internal_task_reset(task);
 		task->dev = dev;
 		task->task_proto = dev->tproto;
 		task->task_done = pm8001_task_done;
@@ -861,7 +1111,8 @@ pm8001_exec_internal_task_abort(struct pm8001_hba_info *pm8001_ha,
 
 		res = TMF_RESP_FUNC_FAILED;
 		spin_lock_irqsave(&pm8001_ha->lock, flags);
-		if (pm8001_tag_alloc(pm8001_ha, &ccb_tag)) {
+		if (pm8001_tag_alloc_internal(pm8001_ha, &ccb_tag)) {
+			del_timer(&task->slow_task->timer);
 			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
 			goto ex_err;
 		}
@@ -875,6 +1126,9 @@ pm8001_exec_internal_task_abort(struct pm8001_hba_info *pm8001_ha,
 
 		if (res) {
 			del_timer(&task->slow_task->timer);
+			/* the pooled task and tag go back, not to the ccb */
+			ccb->task = NULL;
+			pm8001_tag_free(pm8001_ha, ccb_tag);
 			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
 			PM8001_FAIL_DBG(pm8001_ha,
 				pm8001_printk("Executing internal task "
@@ -923,13 +1177,9 @@ pm8001_exec_internal_task_abort(struct pm8001_hba_info *pm8001_ha,
 		PM8001_EH_DBG(pm8001_ha,
 			pm8001_printk(" Task to dev %016llx response: 0x%x status 0x%x\n",
 			    SAS_ADDR(dev->sas_addr), task->task_status.resp, task->task_status.stat));
-		pm8001_free_task(task);
-		task = NULL;
 	}
 ex_err:
-	BUG_ON(retry == 3 && task != NULL);
-	if (task != NULL)
-		pm8001_free_task(task);
+	pm8001_internal_task_put(pm8001_ha, task);
 	return res;
 }
 
@@ -937,6 +1187,32 @@ ex_err:
   * pm8001_dev_gone_notify - see the comments for "pm8001_dev_found_notify"
   * @dev: the device structure which sas layer used.
   */
+/**
+  * pm8001_reg_detach - give up on an outstanding registration.
+  * @pm8001_ha: our hba card information
+  * @pm8001_dev: the device whose OPC_INB_REG_DEV timed out
+  *
+  * HA lock is held. The CCB keeps its tag until the FW answers, but no
+  * longer points at the device, so a late mpi_reg_resp drops the reply
+  * instead of touching a slot that may since have been freed and reused.
+  */
+static void pm8001_reg_detach(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_device *pm8001_dev)
+{
+	struct pm8001_ccb_info *ccb;
+	int i;
+
+	FOR_ALL_CCB(ccb) {
+		if ((ccb->device != pm8001_dev)
+		 || (ccb->ccb_tag == 0xFFFFFFFF)
+		 || ((ccb->opCode & 0xfff) != OPC_INB_REG_DEV))
+			continue;
+		DEC_REQ(pm8001_dev, pm8001_ha);
+		ccb->device = NULL;
+	}
+	pm8001_dev->reg_pending = 0;
+}
+
 static void pm8001_dev_gone_notify(struct domain_device *dev)
 {
 	unsigned long flags = 0;
@@ -944,7 +1220,25 @@ static void pm8001_dev_gone_notify(struct domain_device *dev)
 	struct pm8001_device *pm8001_dev = dev->lldd_dev;
 
 	pm8001_ha = pm8001_find_ha_by_dev(dev);
+	/* a batched port abort or re-registration may be using the device */
+	mutex_lock(&pm8001_ha->port_abort_mutex);
 	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	/* the device can not go away under an outstanding registration */
+	while (pm8001_dev && pm8001_dev->reg_pending) {
+		unsigned long left;
+
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		left = wait_for_completion_timeout(&pm8001_dev->reg_completion,
+			PM8001_TASK_TIMEOUT * HZ);
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		if (!left) {
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("dev[%d] registration lost\n",
+				pm8001_dev->id));
+			pm8001_reg_detach(pm8001_ha, pm8001_dev);
+			break;
+		}
+	}
 	if (pm8001_dev) {
 		u32 device_id = pm8001_dev->device_id;
 
@@ -972,7 +1266,9 @@ static void pm8001_dev_gone_notify(struct domain_device *dev)
 				dev, 1, 0);
 			spin_lock_irqsave(&pm8001_ha->lock, flags);
 		}
-		PM8001_CHIP_DISP->dereg_dev_req(pm8001_ha, device_id);
+		/* never registered, or the registration was lost */
+		if (device_id != PM8001_MAX_DEVICES)
+			PM8001_CHIP_DISP->dereg_dev_req(pm8001_ha, device_id);
 		if (pm8001_dev->running_req) {
 			PM8001_FAIL_DBG(pm8001_ha, pm8001_printk("freeing device with %d still running\n", pm8001_dev->running_req));
 		}
@@ -983,6 +1279,7 @@ static void pm8001_dev_gone_notify(struct domain_device *dev)
 	}
 	dev->lldd_dev = NULL;
 	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	mutex_unlock(&pm8001_ha->port_abort_mutex);
 }
 
 void pm8001_dev_gone(struct domain_device *dev)
@@ -997,14 +1294,53 @@ void pm8001_dev_gone(struct domain_device *dev)
  *
  * They will eventually complete but ULP expects that any aborts
  * that are going to happen will have happened before reset ops complete.
+ *
+ * With @release the FW is known to be done with the command, so its
+ * DMA mapping, tag and running_req count go as well.
  */
-void pm8001_cancel_requests(struct domain_device *dev, int rc)
+static void pm8001_cancel_ccb(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb, int release)
 {
-	struct pm8001_hba_info *pm8001_ha;
-	struct pm8001_device *pm8001_dev = dev->lldd_dev;
 	struct sas_task *t;
 	struct task_status_struct *ts;
 	unsigned long state;
+	u32 tag = ccb->ccb_tag;
+	u32 *m;
+
+	m = (u32 *) ccb->cmd;
+	PM8001_EH_DBG(pm8001_ha,
+		pm8001_printk("ccb %p CCB tag 0x%x opc %x\n", ccb, m[0], ccb->opCode & 0xfff));
+
+	t = ccb->task;
+	ts = &t->task_status;
+	if (release) {
+		DEC_REQ(ccb->device, pm8001_ha);
+		pm8001_ccb_task_free(pm8001_ha, t, ccb, tag);
+	}
+	spin_lock(&t->task_state_lock);
+	state = t->task_state_flags;
+	ts->resp = SAS_TASK_COMPLETE;
+	ts->stat = SAS_ABORTED_TASK;
+	t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
+	t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
+	t->task_state_flags |= SAS_TASK_STATE_DONE;
+	t->lldd_task = NULL;
+	ccb->task = NULL;
+	if (likely((state & SAS_TASK_AT_INITIATOR)) && t->task_done) {
+		spin_unlock(&t->task_state_lock);
+		PM8001_FAIL_DBG(pm8001_ha, pm8001_printk("Aborting Pending task 0x%p tag 0x%x !!\n",
+							 t, tag));
+		mb();/* in order to force CPU ordering */
+		t->task_done(t);
+	} else {
+		spin_unlock(&t->task_state_lock);
+	}
+}
+
+void pm8001_cancel_requests(struct domain_device *dev, int rc)
+{
+	struct pm8001_hba_info *pm8001_ha;
+	struct pm8001_device *pm8001_dev = dev->lldd_dev;
 	unsigned long flags = 0;
 
 	/*
@@ -1020,7 +1356,6 @@ void pm8001_cancel_requests(struct domain_device *dev, int rc)
 		spin_lock_irqsave(&pm8001_ha->lock, flags);
 		if (pm8001_dev->running_req) {
 			int i;
-			u32 *m;
 			struct pm8001_ccb_info *ccb;
 
 			pm8001_printk("CLEANING TASKS %p rrq %d id %d\n", pm8001_dev, pm8001_dev->running_req, pm8001_dev->id);
@@ -1028,30 +1363,7 @@ void pm8001_cancel_requests(struct domain_device *dev, int rc)
 					if (ccb->device != pm8001_dev || ccb->task == NULL) {
 						continue;
 					}
-					m = (u32 *) ccb->cmd;
-					PM8001_EH_DBG(pm8001_ha, 
-						pm8001_printk("ccb %p CCB tag 0x%x opc %x\n", ccb, m[0], ccb->opCode & 0xfff));
-
-					t = ccb->task;
-					ts = &t->task_status;
-					spin_lock(&t->task_state_lock);
-					state = t->task_state_flags;
-					ts->resp = SAS_TASK_COMPLETE;
-					ts->stat = SAS_ABORTED_TASK;
-					t->task_state_flags &= ~SAS_TASK_STATE_PENDING;
-					t->task_state_flags &= ~SAS_TASK_AT_INITIATOR;
-					t->task_state_flags |= SAS_TASK_STATE_DONE;
-					t->lldd_task = NULL;
-					ccb->task = NULL;
-					if (likely((state & SAS_TASK_AT_INITIATOR)) && t->task_done) {
-						spin_unlock(&t->task_state_lock);
-						PM8001_FAIL_DBG(pm8001_ha, pm8001_printk("Aborting Pending task 0x%p tag 0x%x !!\n",
-																 t,ccb->ccb_tag));
-						mb();/* in order to force CPU ordering */
-						t->task_done(t);
-					} else {
-						spin_unlock(&t->task_state_lock);
-					}
+					pm8001_cancel_ccb(pm8001_ha, ccb, 0);
 				} /* for each ccb */
 		}     /* if requests pending */
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
@@ -1059,6 +1371,209 @@ void pm8001_cancel_requests(struct domain_device *dev, int rc)
 
 }
 
+struct pm8001_port_abort {
+	struct pm8001_device	*pm8001_dev;
+	struct sas_task		*task;
+	u32			ccb_tag;
+	int			done;	/* the FW completed the ABORT_ALL */
+};
+
+/**
+  * pm8001_port_lost - queue the devices behind a failed port for abort.
+  * @pm8001_ha: our hba card information
+  * @sas_port: the port which lost its last phy
+  *
+  * called from the hw event handler with pm8001_ha->lock held, before
+  * libsas has had a chance to deform the port.
+  */
+void pm8001_port_lost(struct pm8001_hba_info *pm8001_ha,
+	struct asd_sas_port *sas_port)
+{
+	struct pm8001_device *pm8001_dev;
+	int count = 0;
+
+	if (!sas_port)
+		return;
+	list_for_each_entry(pm8001_dev, &pm8001_ha->active_dev_list, list) {
+		if (!pm8001_dev->sas_device
+		 || (pm8001_dev->sas_device->port != sas_port))
+			continue;
+		pm8001_dev->port_lost = 1;
+		count++;
+	}
+	PM8001_EH_DBG(pm8001_ha,
+		pm8001_printk("port %d lost with %d devices\n",
+		sas_port->id, count));
+}
+
+/**
+  * pm8001_abort_lost_devices - abort everything behind the failed ports.
+  * @pm8001_ha: our hba card information
+  *
+  * rather than leave the error handler to abort each command and reset each
+  * device in turn, every one of them waiting out its own timeout, an
+  * ABORT_ALL goes to every device pm8001_port_lost marked all at once, and
+  * the responses are waited for against a single deadline.
+  *
+  * The ABORT_ALL is queued behind the device's I/O, so once it completes
+  * successfully the FW has fetched every command marked before it was
+  * sent; those it did not hand back are completed and released in one
+  * pass over the CCBs. Devices whose abort failed or timed out are left
+  * to the error handler, as are commands issued after the abort.
+  */
+void pm8001_abort_lost_devices(struct pm8001_hba_info *pm8001_ha)
+{
+	struct pm8001_port_abort *batch;
+	struct pm8001_device *pm8001_dev;
+	struct pm8001_ccb_info *ccb;
+	unsigned long flags, expires;
+	int i, n, count;
+
+	/* dev_gone waits for us, so no device is freed under the batch */
+	mutex_lock(&pm8001_ha->port_abort_mutex);
+	for (;;) {
+		count = 0;
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		list_for_each_entry(pm8001_dev, &pm8001_ha->active_dev_list,
+			list)
+			if (pm8001_dev->port_lost)
+				count++;
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		if (!count)
+			break;
+		batch = PMALLOC(count * sizeof(*batch), GFP_KERNEL);
+		if (!batch) {
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("no memory to abort %d devices\n",
+				count));
+			break;
+		}
+
+		n = 0;
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		list_for_each_entry(pm8001_dev, &pm8001_ha->active_dev_list,
+			list) {
+			if (!pm8001_dev->port_lost || (n >= count))
+				continue;
+			pm8001_dev->port_lost = 0;
+			if (!pm8001_dev->running_req || pm8001_dev->reg_pending)
+				continue;
+			pm8001_dev->port_abort = 1;
+			batch[n++].pm8001_dev = pm8001_dev;
+		}
+		FOR_ALL_CCB(ccb) {
+			if (ccb->device && ccb->device->port_abort && ccb->task)
+				ccb->aborting = 1;
+		}
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		PM8001_EH_DBG(pm8001_ha,
+			pm8001_printk("aborting %d devices\n", n));
+
+		/* fire them all off before waiting on any */
+		expires = jiffies + PM8001_TASK_TIMEOUT * HZ;
+		for (i = 0; i < n; i++) {
+			struct sas_task *task;
+			u32 ccb_tag;
+			int res;
+
+			pm8001_dev = batch[i].pm8001_dev;
+			task = pm8001_internal_task_get(pm8001_ha);
+			if (!task)
+				continue;
+			task->dev = pm8001_dev->sas_device;
+			task->task_proto = task->dev->tproto;
+			task->task_done = pm8001_task_done;
+			task->slow_task->timer.data = (unsigned long)task;
+			task->slow_task->timer.function = pm8001_tmf_timedout;
+			task->slow_task->timer.expires = expires;
+			add_timer(&task->slow_task->timer);
+
+			spin_lock_irqsave(&pm8001_ha->lock, flags);
+			res = pm8001_tag_alloc_internal(pm8001_ha, &ccb_tag);
+			if (!res) {
+				ccb = get_ccb_array(pm8001_ha, ccb_tag);
+				ccb->device = pm8001_dev;
+				ccb->ccb_tag = ccb_tag;
+				ccb->task = task;
+				res = PM8001_CHIP_DISP->task_abort(pm8001_ha,
+					pm8001_dev, 1, 0, ccb_tag);
+				if (res) {
+					ccb->task = NULL;
+					pm8001_tag_free(pm8001_ha, ccb_tag);
+				}
+			}
+			if (res) {
+				del_timer(&task->slow_task->timer);
+				spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+				PM8001_FAIL_DBG(pm8001_ha,
+					pm8001_printk("ABORT_ALL to dev[%x] "
+					"failed\n", pm8001_dev->device_id));
+				pm8001_internal_task_put(pm8001_ha, task);
+				continue;
+			}
+			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			batch[i].task = task;
+			batch[i].ccb_tag = ccb_tag;
+		}
+
+		for (i = 0; i < n; i++) {
+			struct sas_task *task = batch[i].task;
+
+			if (!task)
+				continue;
+			wait_for_completion(&task->slow_task->completion);
+			spin_lock_irqsave(&pm8001_ha->lock, flags);
+			spin_lock(&task->task_state_lock);
+			if ((task->task_state_flags & SAS_TASK_STATE_ABORTED)
+			 && !(task->task_state_flags & SAS_TASK_STATE_DONE)) {
+				PM8001_FAIL_DBG(pm8001_ha,
+					pm8001_printk("ABORT_ALL to dev[%x] "
+					"timeout\n",
+					batch[i].pm8001_dev->device_id));
+				/* a late response finds the tag retired */
+				ccb = get_ccb_array(pm8001_ha, batch[i].ccb_tag);
+				if (ccb->task == task) {
+					ccb->task = NULL;
+					ccb->ccb_tag = 0xFFFFFFFF;
+					ccb->aborting = 0;
+					ccb->open_retry = 0;
+					pm8001_ccb_free(pm8001_ha,
+						batch[i].ccb_tag);
+				}
+			} else if ((task->task_state_flags &
+				    SAS_TASK_STATE_DONE) &&
+				   (task->task_status.resp ==
+				    SAS_TASK_COMPLETE) &&
+				   (task->task_status.stat == SAM_STAT_GOOD))
+				batch[i].done = 1;
+			spin_unlock(&task->task_state_lock);
+			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			pm8001_internal_task_put(pm8001_ha, task);
+		}
+
+		/* anything the FW did not hand back goes up in one pass */
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		for (i = 0; i < n; i++) {
+			if (batch[i].done)
+				continue;
+			PM8001_EH_DBG(pm8001_ha,
+				pm8001_printk("dev[%x] left to the error "
+				"handler\n", batch[i].pm8001_dev->device_id));
+			batch[i].pm8001_dev->port_abort = 0;
+		}
+		FOR_ALL_CCB(ccb) {
+			if (!ccb->device || !ccb->device->port_abort
+			 || !ccb->task || !ccb->aborting)
+				continue;
+			pm8001_cancel_ccb(pm8001_ha, ccb, 1);
+		}
+		for (i = 0; i < n; i++)
+			batch[i].pm8001_dev->port_abort = 0;
+		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+		PMFREE(batch, count * sizeof(*batch));
+	}
+	mutex_unlock(&pm8001_ha->port_abort_mutex);
+}
 
 static int pm8001_issue_ssp_tmf(struct domain_device *dev,
 	u8 *lun, struct pm8001_tmf_task *tmf)
@@ -1458,43 +1973,176 @@ int pm8001_eh_bus_reset_handler(struct scsi_cmnd *cmnd)
 /**
  *	pm8001_reregister_dev
  *	@pm8001_ha: our hba card information
+ *
+ *	The registrations are pipelined: OPC_INB_REG_DEV goes out for every
+ *	known device back to back, and we only stop to let the FW catch up
+ *	when we run out of tags or IOMBs. mpi_reg_resp completes reg_drained
+ *	once per response, reg_outstanding tells us when all are back.
  */
 static void pm8001_reregister_dev(struct pm8001_hba_info *pm8001_ha)
 {
-	u32 i;
+	u32 count = 0;
+	int rc;
+	unsigned long flags;
+	struct pm8001_device *pm8001_dev;
+	DECLARE_COMPLETION_ONSTACK(drained);
 
-	for (i = 0; i < PM8001_MAX_DEVICES; i++) {
-		unsigned long flags;
+	/*
+	 * The lock is dropped while we wait for the FW below. dev_gone only
+	 * waits a bounded time for reg_pending, so it is held off entirely
+	 * rather than let it unlink the entry the walk is on.
+	 */
+	mutex_lock(&pm8001_ha->port_abort_mutex);
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	/* anything outstanding was lost with the reset */
+	pm8001_ha->reg_outstanding = 0;
+	pm8001_ha->reg_drained = &drained;
+	list_for_each_entry(pm8001_dev, &pm8001_ha->active_dev_list, list) {
 		int direct;
 		struct domain_device *dev;
-		DECLARE_COMPLETION_ONSTACK(completion);
-		struct pm8001_device *pm8001_dev = &pm8001_ha->devices[i];
-
-		if (pm8001_dev->dev_type == SAS_PHY_UNUSED)
-			continue;
 
 		direct = 0;
 		dev = pm8001_dev->sas_device;
 		if (dev && !dev->parent && (dev->dev_type == SAS_SATA_DEV))
 			direct = 1;
-		pm8001_dev->dcompletion = &completion;
-		spin_lock_irqsave(&pm8001_ha->lock, flags);
-		PM8001_CHIP_DISP->reg_dev_req(pm8001_ha, pm8001_dev, direct);
+		if (!pm8001_dev->reg_pending) {
+			init_completion(&pm8001_dev->reg_completion);
+			pm8001_dev->reg_pending = 1;
+		}
+		/* the FW hands out new device IDs, drop the stale one */
+		pm8001_dev->device_id = PM8001_MAX_DEVICES;
+		pm8001_dev->dcompletion = &pm8001_dev->reg_completion;
+		for (;;) {
+			unsigned long left;
+
+			rc = PM8001_CHIP_DISP->reg_dev_req(pm8001_ha,
+				pm8001_dev, direct);
+			if (!rc || !pm8001_ha->reg_outstanding)
+				break;
+			/* out of tags or IOMBs, let the FW catch up */
+			spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+			left = wait_for_completion_timeout(&drained,
+				PM8001_TASK_TIMEOUT * HZ);
+			spin_lock_irqsave(&pm8001_ha->lock, flags);
+			if (!left)
+				break;
+		}
+		if (rc) {
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("dev[%d] 0x%016llx not registered\n",
+					pm8001_dev->id,
+					dev ? SAS_ADDR(dev->sas_addr) : 0ULL));
+			pm8001_dev->reg_pending = 0;
+			complete_all(&pm8001_dev->reg_completion);
+			continue;
+		}
+		count++;
+	}
+	while (pm8001_ha->reg_outstanding) {
+		unsigned long left;
+
 		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-		wait_for_completion(&completion);
-		PM8001_EH_DBG(pm8001_ha,
-			pm8001_printk("dev[%d:%x] 0x%016llx registered.\n",
-				pm8001_dev->device_id,
-				pm8001_dev->dev_type,
-				SAS_ADDR(dev->sas_addr)));
+		left = wait_for_completion_timeout(&drained,
+			PM8001_TASK_TIMEOUT * HZ);
+		spin_lock_irqsave(&pm8001_ha->lock, flags);
+		if (!left) {
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("%u registrations timed out\n",
+					pm8001_ha->reg_outstanding));
+			break;
+		}
+	}
+	/* release whoever waits on a registration that never came back */
+	list_for_each_entry(pm8001_dev, &pm8001_ha->active_dev_list, list) {
+		if (!pm8001_dev->reg_pending)
+			continue;
+		/* device_id stays PM8001_MAX_DEVICES: no tasks are taken */
+		pm8001_reg_detach(pm8001_ha, pm8001_dev);
+		complete_all(&pm8001_dev->reg_completion);
+		count--;
+	}
+	pm8001_ha->reg_outstanding = 0;
+	pm8001_ha->reg_drained = NULL;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	mutex_unlock(&pm8001_ha->port_abort_mutex);
+	PM8001_EH_DBG(pm8001_ha,
+		pm8001_printk("%u devices re-registered\n", count));
+}
+
+/**
+ *	pm8001_phys_up - bring all phys back after a chip reset
+ *	@pm8001_ha: our hba card information
+ *
+ *	All phys are started at once and share one completion for their
+ *	HW_EVENT_PHY_START_STATUS. After the link resets we wait for the
+ *	phys that had a link before the reset to report phy up again, for no
+ *	longer than the settle time we used to sleep unconditionally.
+ */
+#define PM8001_PHY_SETTLE	(2 * HZ)
+static int pm8001_phys_up(struct pm8001_hba_info *pm8001_ha)
+{
+	int ret = 0, phy_id, started = 0;
+	u32 expected = 0;
+	unsigned long flags, deadline;
+	DECLARE_COMPLETION_ONSTACK(completion);
+	DECLARE_COMPLETION_ONSTACK(link);
+
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	for (phy_id = 0; phy_id < pm8001_ha->chip->n_phy; ++phy_id) {
+		if (pm8001_ha->phy[phy_id].phy_attached)
+			expected |= 1U << phy_id;
+	}
+	pm8001_ha->phy_up_completion = &link;
+	for (phy_id = 0; phy_id < pm8001_ha->chip->n_phy; ++phy_id) {
+		pm8001_ha->phy[phy_id].enable_completion = &completion;
+		ret = PM8001_CHIP_DISP->phy_start_req(pm8001_ha, phy_id);
+		if (ret) {
+			pm8001_ha->phy[phy_id].enable_completion = NULL;
+			break;
+		}
+		started++;
+	}
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	deadline = jiffies + PM8001_PHY_SETTLE;
+	while (started--) {
+		if (!wait_for_completion_timeout(&completion,
+			PM8001_PHY_SETTLE)) {
+			PM8001_FAIL_DBG(pm8001_ha,
+				pm8001_printk("phy start timed out\n"));
+			ret = -ETIMEDOUT;
+			break;
+		}
+	}
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	for (phy_id = 0; phy_id < pm8001_ha->chip->n_phy; ++phy_id) {
+		pm8001_ha->phy[phy_id].enable_completion = NULL;
+		if (!ret)
+			PM8001_CHIP_DISP->phy_ctl_req(pm8001_ha, phy_id,
+				PHY_LINK_RESET);
+	}
+	/* phy ups from the start itself must not count, only the reset's */
+	pm8001_ha->phy_up_mask = 0;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	while (!ret && (pm8001_ha->phy_up_mask & expected) != expected) {
+		long left = (long)(deadline - jiffies);
+
+		if (left <= 0 || !wait_for_completion_timeout(&link, left)) {
+			PM8001_EH_DBG(pm8001_ha,
+				pm8001_printk("phys 0x%x of 0x%x up\n",
+				pm8001_ha->phy_up_mask & expected, expected));
+			break;
+		}
 	}
+	spin_lock_irqsave(&pm8001_ha->lock, flags);
+	pm8001_ha->phy_up_completion = NULL;
+	spin_unlock_irqrestore(&pm8001_ha->lock, flags);
+	return ret;
 }
 
 static int pm8001_host_reset(struct pm8001_hba_info *pm8001_ha)
 {
 	int ret, phy_id;
 	unsigned long flags;
-	DECLARE_COMPLETION_ONSTACK(completion);
 
 	PM8001_CHIP_DISP->chip_rst(pm8001_ha);
 	ret = PM8001_CHIP_DISP->chip_hda_mode(pm8001_ha);
@@ -1504,18 +2152,8 @@ static int pm8001_host_reset(struct pm8001_hba_info *pm8001_ha)
 	if (ret)
 		return FAILED;
 	PM8001_CHIP_DISP->interrupt_enable(pm8001_ha);
-	for (phy_id = 0; phy_id < pm8001_ha->chip->n_phy; ++phy_id) {
-		pm8001_ha->phy[phy_id].enable_completion = &completion;
-		spin_lock_irqsave(&pm8001_ha->lock, flags);
-		ret = PM8001_CHIP_DISP->phy_start_req(pm8001_ha, phy_id);
-		spin_unlock_irqrestore(&pm8001_ha->lock, flags);
-		if (ret)
-			return FAILED;
-		wait_for_completion(&completion);
-		PM8001_CHIP_DISP->phy_ctl_req(pm8001_ha, phy_id,
-					      PHY_LINK_RESET);
-	}
-	msleep(2000); /* phy start and phy reset settling time */
+	if (pm8001_phys_up(pm8001_ha))
+		return FAILED;
 	pm8001_reregister_dev(pm8001_ha);
 	/* Close the window should we have missed any events */
 	for (phy_id = 0; phy_id < pm8001_ha->chip->n_phy; ++phy_id) {
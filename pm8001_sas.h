@@ -46,10 +46,12 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
 #include <linux/delay.h>
 #include <linux/types.h>
 #include <linux/ctype.h>
 #include <linux/dma-mapping.h>
+#include <linux/dmapool.h>
 #include <linux/pci.h>
 #include <linux/interrupt.h>
 #include <linux/workqueue.h>
@@ -147,6 +149,7 @@ struct pm8001_ioctl_payload {
 	u16	offset;
 	u16	id;
 	u8	*func_specific;
+	dma_addr_t func_dma;/* data already mapped for the device, or 0 */
 };
 
 struct pm8001_dispatch {
@@ -227,16 +230,26 @@ struct pm8001_phy {
 };
 
 struct pm8001_device {
+	struct list_head	list;/* on free_dev_list or active_dev_list */
 	enum sas_device_type	dev_type;
 	struct domain_device	*sas_device;
 	u32			attached_phy;
 	u32			id;
 	struct completion	*dcompletion;
 	struct completion	*setds_completion;
+	struct completion	reg_completion;
 	u32			device_id;
 	u32			running_req;
 	int dying;
 	int orej;
+	int reg_pending;	/* OPC_INB_REG_DEV outstanding */
+	int port_lost;		/* behind a failed port, abort queued */
+	int port_abort;		/* in the running batched abort */
+	u32 ncq_tags;		/* NCQ tags outstanding at the drive */
+	u32 ncq_peak;		/* most NCQ tags ever outstanding at once */
+	u64 ncq_cmds;		/* NCQ commands issued */
+	u64 ncq_active_sum;	/* tags outstanding, summed over ncq_cmds */
+	u64 non_ncq_cmds;	/* SATA commands which drain the queue */
 };
 #define	INC_REQ(d, h)										\
 	(d)->running_req++;									\
@@ -271,11 +284,17 @@ struct pm8001_ccb_info {
 	dma_addr_t		ccb_dma_handle;
 	struct pm8001_device	*device;
 	struct pm8001_prd	buf_prd[PM8001_MAX_DMA_SG];
+	/* further PRD tables, linked through the last PRD of the previous */
+	struct pm8001_prd	*prd_chain[PM8001_MAX_PRD_CHAIN];
+	dma_addr_t		prd_chain_dma[PM8001_MAX_PRD_CHAIN];
+	u32			n_prd_chain;
 	struct fw_control_ex	*fw_control_context;
 	u32			opCode;
-	u8			cmd[60];
+	u8			cmd[124];/* IOMB payload, up to two elements */
 	u8			aborting;
 	u8			open_retry;
+	u8			ncq_active;/* ncq_tag is held at the device */
+	u8			ncq_tag;
 };
 
 struct mpi_mem {
@@ -546,6 +565,8 @@ struct inbound_queue_table {
 	u32			reserved;
 	__le32			consumer_index;
 	u32			producer_idx;
+	u32			hpriority;	/* IOMB header bit 30 */
+	u32			response_queue;	/* replies to this OQ */
 };
 struct outbound_queue_table {
 	u32			element_size_cnt;
@@ -586,16 +607,54 @@ struct eventlog_entry {
 	__le32			sequence;
 	__le32			log[4];
 };
+
+/**
+ * pm8001_validlog - generic routine to validate a single event log entry
+ * @entry: a pointer to the event log entry
+ * @return: zero if not valid
+ */
+static inline int pm8001_validlog(struct eventlog_entry *entry)
+{
+	return ((entry->size <= (sizeof(entry->log) / sizeof(entry->log[0]))) &&
+		((entry->timestamp_upper != 0) ||
+		 (entry->timestamp_lower != 0)));
+}
+
 struct pm8001_hba_memspace {
 	void __iomem  		*memvirtaddr;
 	u64			membase;
 	u32			memsize;
 };
+/* controller bring-up waits, timed by pm8001_poll */
+enum pm8001_init_phase {
+	PM8001_PHASE_FW_READY,		/* scratch pads 1 and 2 ready */
+	PM8001_PHASE_MPI_INIT,		/* config table update doorbell */
+	PM8001_PHASE_MPI_UNINIT,	/* config table reset doorbell */
+	PM8001_PHASE_MPI_STOP,		/* MPI state uninitialized */
+	PM8001_PHASE_RST_NMI,		/* firmware ready after RB6 NMI */
+	PM8001_PHASE_RST_SETTLE,	/* soft reset settle time */
+	PM8001_PHASE_RST_TOGGLE,	/* scratch pad 1 reset bit toggle */
+	PM8001_PHASE_HDA_IDLE,		/* boot ROM idle in HDA mode */
+	PM8001_PHASE_HDA_EXEC,		/* boot ROM accepts the ILA */
+	PM8001_PHASE_HDA_AAP1,		/* ILA asks for the AAP1 image */
+	PM8001_PHASE_HDA_IOP,		/* ILA asks for the IOP image */
+	PM8001_PHASE_HDA_READY,		/* firmware up after HDA boot */
+	PM8001_PHASE_MAX
+};
+
 struct pm8001_hba_info {
 	char			name[PM8001_NAME_LENGTH];
 	struct list_head	list;
 	unsigned long		flags;
 	spinlock_t		lock;/* host-wide lock */
+	/*
+	 * Serializes users of the BAR 2 (GSM) window, all of which run in
+	 * process context. Window users that also need the host lock take
+	 * this first.
+	 */
+	struct mutex		bar4_mutex;
+	/* batched abort and re-registration vs dev_gone */
+	struct mutex		port_abort_mutex;
 	struct pci_dev		*pdev;/* our device */
 	struct device		*dev;
 	struct pm8001_hba_memspace io_mem[6];
@@ -617,10 +676,18 @@ struct pm8001_hba_info {
 	u32			chip_id;
 	const struct pm8001_chip_info	*chip;
 	struct completion	*nvmd_completion;
+	u32			reg_outstanding;/* OPC_INB_REG_DEV in flight */
+	struct completion	*reg_drained;/* completed per OPC_OUB_DEV_REGIST */
+	u32			phy_up_mask;/* phys with link up */
+	unsigned long		phy_up_jiffies;/* when the last phy came up */
+	struct completion	*phy_up_completion;/* completed per phy up */
 	u16			tags_serno;
 	int			tags_alloc;
 	int			tags_num;
 	unsigned long		*tags;
+	/* Error handling never allocates, see pm8001_internal_task_get() */
+	struct sas_task		*internal_task[PM8001_INTERNAL_TASKS];
+	unsigned long		internal_task_busy;
 #define	TAG_IDX_MASK(x)	(x & 0xffff)
 #define	TAG_MAKE(h, t)	((((((h)->tags_serno++) & 0x7fff) | 0x8000) << 16) | t)
 	struct pm8001_phy	phy[PM8001_MAX_PHYS];
@@ -628,11 +695,14 @@ struct pm8001_hba_info {
 	u32			id;
 	u32			irq;
 	struct pm8001_device	*devices;
+	struct list_head	free_dev_list;
+	struct list_head	active_dev_list;
 #if (PM8001_MAX_CCB_ARRAY == 1)
 	struct pm8001_ccb_info	*ccb_info;
 #else
 	struct pm8001_ccb_info	*ccb_info[PM8001_MAX_CCB_ARRAY];	
 #endif	
+	struct dma_pool		*prd_pool;/* chained PRD tables */
 #ifdef PM8001_USE_MSIX
 	struct msix_entry	msix_entries[16];/*for msi-x interrupt*/
 	int			number_of_intr;/*will be used in remove()*/
@@ -644,8 +714,15 @@ struct pm8001_hba_info {
 	u32			logging_level;
 	u32			logging_option;
 	u32			fw_status;
+	u32			fw_flash_done;/* image bytes acknowledged */
+	u32			fw_flash_total;/* image bytes to send */
 	const struct firmware 	*fw_image;
+	struct pm8001_flash_job	*flash_job;/* abandoned, image still DMA'd */
+	struct work_struct	flash_reap_work;/* frees flash_job */
 	u32			rst_signature;
+	struct completion	probe_done;/* bring-up finished */
+	u32			init_phase_us[PM8001_PHASE_MAX];/* last wait */
+	int			probe_rc;/* bring-up result */
 #ifdef _CONFIG_SCSI_PM8001_DEBUG_FS
 # undef CONFIG_SCSI_PM8001_DEBUG_FS
 # define CONFIG_SCSI_PM8001_DEBUG_FS
@@ -655,6 +732,18 @@ struct pm8001_hba_info {
 #endif
 #ifdef CONFIG_SCSI_PM8001_DEBUG_FS
 	struct dentry		*hba_debugfs_root;
+	atomic_t		debugfs_mmaps;/* live region mappings */
+	atomic_t		debugfs_users;/* itself, mappings, open nodes */
+	struct rw_semaphore	debugfs_sem;/* debugfs_gone vs hardware reads */
+	int			debugfs_gone;/* terminated, nodes fail */
+	struct mutex		debugfs_map_mutex;/* the two below */
+	struct list_head	debugfs_mapped;/* nodes with region mappings */
+	int			debugfs_revoked;/* regions about to be freed */
+	/* Wakes event log streams when a producer index moves */
+	wait_queue_head_t	eventlog_wait;
+	struct delayed_work	eventlog_work;
+	spinlock_t		eventlog_lock;/* the flag below, and the logs */
+	int			eventlog_terminating;/* no more re-arming */
 #endif
 	/* Local consumer indexes in support of sysfs event log node */
 	u32			aap1_consumer;
@@ -738,6 +827,9 @@ struct fw_control_ex {
 /* pm8001 workqueue */
 extern struct workqueue_struct *pm8001_wq;
 
+/* ms to hold off after registering an end device, 0 for none */
+extern int pm8001_dev_settle;
+
 /* Find the ccb array */
 static __inline struct pm8001_ccb_info *get_ccb_array(
 				struct pm8001_hba_info *pm8001_ha, u32 tag);
@@ -763,8 +855,16 @@ static __inline struct pm8001_ccb_info *get_ccb_array(
 void pm8001_tag_free(struct pm8001_hba_info *pm8001_ha, u32 tag);
 int pm8001_tag_alloc(struct pm8001_hba_info *pm8001_ha, u32 *tag_out);
 void pm8001_tag_init(struct pm8001_hba_info *pm8001_ha);
+int pm8001_tag_alloc_internal(struct pm8001_hba_info *pm8001_ha, u32 *tag_out);
+int pm8001_internal_task_init(struct pm8001_hba_info *pm8001_ha);
+void pm8001_internal_task_free(struct pm8001_hba_info *pm8001_ha);
 u32 pm8001_get_ncq_tag(struct sas_task *task, u32 *tag);
+struct pm8001_hba_info *pm8001_find_ha_by_dev(struct domain_device *dev);
 void pm8001_ccb_free(struct pm8001_hba_info *pm8001_ha, u32 ccb_idx);
+void pm8001_prd_chain_free(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb);
+void pm8001_ncq_tag_get(struct pm8001_hba_info *pm8001_ha,
+	struct pm8001_ccb_info *ccb, u32 ncq_tag);
 void pm8001_ccb_task_free(struct pm8001_hba_info *pm8001_ha,
 	struct sas_task *task, struct pm8001_ccb_info *ccb, u32 ccb_idx);
 int pm8001_phy_control(struct asd_sas_phy *sas_phy, enum phy_func func
@@ -787,6 +887,9 @@ void pm8001_open_reject_retry(
 	struct pm8001_hba_info *pm8001_ha,
 	struct sas_task *task_to_close,
 	struct pm8001_device *device_to_close);
+void pm8001_port_lost(struct pm8001_hba_info *pm8001_ha,
+	struct asd_sas_port *sas_port);
+void pm8001_abort_lost_devices(struct pm8001_hba_info *pm8001_ha);
 int pm8001_eh_bus_reset_handler(struct scsi_cmnd *cmnd);
 int pm8001_eh_host_reset_handler(struct scsi_cmnd *cmnd);
 int pm8001_clear_nexus_ha(struct sas_ha_struct *ha);
@@ -798,12 +901,27 @@ int pm8001_readlog(
 	struct eventlog_header *header,
 	struct eventlog_entry *entry,
 	u32 *consumer_index);
+int pm8001_formatlog(struct eventlog_entry *entry, char *buf, size_t len);
 void pm8001_debugfs_initialize(struct pm8001_hba_info *pm8001_ha);
 void pm8001_debugfs_terminate(struct pm8001_hba_info *pm8001_ha);
+void pm8001_debugfs_revoke(struct pm8001_hba_info *pm8001_ha);
+void pm8001_debugfs_put(struct pm8001_hba_info *pm8001_ha);
+void pm8001_debugfs_eventlog_work(PMCS_WORK_ARG work);
 int pm8001_bar4_shift(struct pm8001_hba_info *pm8001_ha, u32 shiftValue);
+void pm8001_hda_fw_release(void);
+void pm8001_hda_fw_retry(void);
+void pm8001_flash_late_reply(struct pm8001_hba_info *pm8001_ha);
+void pm8001_flash_reap_work(PMCS_WORK_ARG work);
+void pm8001_flash_reap(struct pm8001_hba_info *pm8001_ha);
+extern const char * const pm8001_init_phase_name[PM8001_PHASE_MAX];
 
 /* ctl shared API */
 extern struct PMCS_SYSFS_DEV_ATTR *pm8001_host_attrs[];
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 16, 0)
+extern const struct attribute_group *pm8001_sdev_groups[];
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 19)
+extern struct device_attribute *pm8001_sdev_attrs[];
+#endif
 
 #endif
 